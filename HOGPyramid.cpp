@@ -21,65 +21,223 @@
 
 #include "HOGPyramid.h"
 
+#include <Eigen/Eigenvalues>
+
 #include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <iostream>
 #include <limits>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The vectorized kernels are selected at runtime depending on the CPU
+#if !defined(FFLD_HOGPYRAMID_DOUBLE) && !defined(FFLD_HOGPYRAMID_SCALAR) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define FFLD_HOGPYRAMID_SIMD
+#include <immintrin.h>
+#endif
+
 using namespace Eigen;
 using namespace FFLD;
 using namespace std;
 
+HOGPyramid::Workspace::Workspace()
+{
+}
+
 HOGPyramid::HOGPyramid() : padx_(0), pady_(0), interval_(0)
 {
 }
 
-HOGPyramid::HOGPyramid(const JPEGImage & image, int padx, int pady, int interval) : padx_(0),
-pady_(0), interval_(0)
+HOGPyramid::HOGPyramid(const ImageView & image, int padx, int pady, int interval,
+             bool approximate, Workspace * workspace, double minScale,
+             double maxScale) : padx_(0), pady_(0), interval_(0)
 {
-  if (image.empty() || (padx < 1) || (pady < 1) || (interval < 1)) {
+  if (image.empty() || (padx < 1) || (pady < 1) || (interval < 1) || (minScale < 0.0) ||
+    (maxScale < minScale)) {
     cerr << "Attempting to create an empty pyramid" << endl;
     return;
   }
 
   // Compute the number of scales such that the smallest size of the last level is 5
-  const int maxScale = ceil(log(min(image.width(), image.height()) / 40.0) / log(2.0) * interval);
+  const int maxLevel = ceil(log(min(image.width(), image.height()) / 40.0) / log(2.0) * interval);
 
   // Cannot compute the pyramid on images too small
-  if (maxScale < interval) {
+  if (maxLevel < interval) {
     cerr << "The image is too small to create a pyramid" << endl;
     return;
   }
 
+  // Range of levels of scale between minScale and maxScale (extended to the nearest levels
+  // outside of the range so that it is fully covered)
+  const int firstLevel = max(static_cast<int>(floor(interval * (1.0 - log(maxScale) / log(2.0)) +
+                            1e-6)), 0);
+
+  const int lastLevel = (minScale > 0.0) ?
+              min(static_cast<int>(ceil(interval * (1.0 - log(minScale) / log(2.0)) - 1e-6)),
+                maxLevel) : maxLevel;
+
+  if (firstLevel > lastLevel) {
+    cerr << "The scale range does not contain any pyramid level" << endl;
+    return;
+  }
+
   padx_ = padx;
   pady_ = pady;
   interval_ = interval;
-  levels_.resize(maxScale + 1);
 
-#pragma omp parallel for
+  // Levels to compute: those in the range and those one octave above them, used by the parts
+  vector<bool> needed(maxLevel + 1, false);
+
+  for (int z = firstLevel; z <= lastLevel; ++z) {
+    needed[z] = true;
+
+    if (z >= interval)
+      needed[z - interval] = true;
+  }
+
+  // In approximate mode only the first scale of each octave is computed, and the others are
+  // resampled from the nearest one
+  vector<bool> computed(needed);
+
+  if (approximate) {
+    for (int z = 0; z <= maxLevel; ++z) {
+      if (needed[z] && (z % interval)) {
+        computed[z] = false;
+        computed[NearestComputed(z, interval, maxLevel)] = true;
+      }
+    }
+  }
+
+  // Rescaled images of the third octave onwards (the first two octaves are computed from the
+  // scanlines of the image rescaled on the fly)
+  vector<JPEGImage> images;
+  vector<JPEGImage> & scaled = workspace ? workspace->images_ : images;
+
+  // Reuse the memory of the workspace (the rescaled images and the levels are never shrunk, the
+  // levels not needed are given back to it by trim())
+  if (workspace)
+    levels_.swap(workspace->levels_);
+
+  if (levels_.size() < maxLevel + 1)
+    levels_.resize(maxLevel + 1);
+
+  if (scaled.size() < maxLevel + 1)
+    scaled.resize(maxLevel + 1);
+
+  // Last level computed from each scale of the first octave
+  vector<int> lastLevels(interval, -1);
+
+  for (int z = 0; z <= maxLevel; ++z)
+    if (computed[z])
+      lastLevels[z % interval] = z;
+
+  // Each scale of the first octave gives the levels of the first two octaves (cells of 4 and 8
+  // pixels computed from the same gradients) and the first image of the third octave in a single
+  // pass over the image. The scales are computed one after the other with all the threads working
+  // on bands of rows
   for (int i = 0; i < interval; ++i) {
+    if (lastLevels[i] < 0)
+      continue;
+
     const double scale = pow(2.0, -static_cast<double>(i) / interval);
+    const bool coarse = (i + interval <= maxLevel) && computed[i + interval];
+    JPEGImage * half = (i + 2 * interval <= lastLevels[i]) ? &scaled[i + 2 * interval] : 0;
 
-    JPEGImage* scaled = image.create_rescale(scale);
+    if (computed[i]) {
+      Hog(ImageResampler(image, scale), levels_[i], padx, pady, 4,
+        coarse ? &levels_[i + interval] : 0, half);
+    }
+    else if (coarse) {
+      Hog(ImageResampler(image, scale), levels_[i + interval], padx, pady, 8, 0, half);
+    }
+    else {
+      // Only the images of the next octaves are needed
+      if (i)
+        image.rescale(scale, scaled[i]);
 
-    // First octave at twice the image resolution
-    Hog(*scaled, levels_[i], padx, pady, 4);
+      (i ? ImageView(scaled[i]) : image).rescale(0.5, *half);
+    }
+  }
 
-    // Second octave at the original resolution
-    if (i + interval <= maxScale)
-      Hog(*scaled, levels_[i + interval], padx, pady, 8);
+#pragma omp parallel for
+  for (int i = 0; i < interval; ++i)
+    for (int j = 3; i + j * interval <= lastLevels[i]; ++j)
+      ImageView(scaled[i + (j - 1) * interval]).rescale(0.5, scaled[i + j * interval]);
+
+  // Levels of the third octave onwards, by decreasing size
+  vector<pair<int, int> > order;
+
+  for (int z = 2 * interval; z <= maxLevel; ++z)
+    if (computed[z])
+      order.push_back(pair<int, int>(-scaled[z].width() * scaled[z].height(), z));
+
+  sort(order.begin(), order.end());
+
+  // The largest levels are computed one after the other with all the threads working on bands of
+  // rows, while the smaller ones are computed concurrently
+#ifdef _OPENMP
+  const int nbThreads = omp_get_max_threads();
+#else
+  const int nbThreads = 1;
+#endif
+  int nbLarge = 0;
+
+  while ((nbThreads > 1) && (nbLarge < order.size())) {
+    const int z = order[nbLarge].second;
+
+    if ((scaled[z].height() + 15) / 16 < 2 * nbThreads)
+      break;
+
+    Hog(scaled[z], levels_[z], padx, pady, 8);
+    ++nbLarge;
+  }
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = nbLarge; i < order.size(); ++i) {
+    const int z = order[i].second;
+    Hog(scaled[z], levels_[z], padx, pady, 8);
+  }
+
+  // Remove the levels below the range
+  if (!approximate) {
+    trim(needed, lastLevel, workspace);
+    return;
+  }
+
+  // Resample the other levels from the nearest computed one
+#pragma omp parallel for
+  for (int z = 0; z <= maxLevel; ++z) {
+    const int i = z % interval;
+
+    if (!i || !needed[z])
+      continue;
 
-    // Remaining octaves
-    for (int j = 2; i + j * interval <= maxScale; ++j) {
-      JPEGImage* new_scaled = scaled->create_rescale(0.5);
-      delete scaled;
-      scaled = new_scaled;
-      Hog(*scaled, levels_[i + j * interval], padx, pady, 8);
+    // Size the level would have if it was computed (see JPEGImage::rescale)
+    const double scale = pow(2.0, -static_cast<double>(i) / interval);
+    int width = ceil(image.width() * scale);
+    int height = ceil(image.height() * scale);
+
+    for (int j = 2; j <= z / interval; ++j) {
+      width = ceil(width * 0.5);
+      height = ceil(height * 0.5);
     }
 
-    delete scaled;
+    const int cellSize = (z < interval) ? 4 : 8;
+    const int rows = (height + cellSize / 2) / cellSize;
+    const int cols = (width + cellSize / 2) / cellSize;
+    const int nearest = NearestComputed(z, interval, maxLevel);
+
+    Approximate(levels_[nearest], levels_[z], rows, cols, pow(2.0, (nearest - z) /
+                                     static_cast<double>(interval)),
+          padx, pady);
   }
+
+  // Remove the levels only computed to approximate others, and those below the range
+  trim(needed, lastLevel, workspace);
 }
 
 HOGPyramid::HOGPyramid(int padx, int pady, int interval, vector<Level> & levels) : padx_(0),
@@ -121,6 +279,22 @@ const vector<HOGPyramid::Level> & HOGPyramid::levels() const
   return levels_;
 }
 
+void HOGPyramid::release(Workspace & workspace)
+{
+  // The workspace already holds the levels this pyramid did not need
+  if (workspace.levels_.size() < levels_.size())
+    workspace.levels_.resize(levels_.size());
+
+  for (int z = 0; z < levels_.size(); ++z)
+    if (levels_[z].size())
+      workspace.levels_[z].swap(levels_[z]);
+
+  levels_.clear();
+  padx_ = 0;
+  pady_ = 0;
+  interval_ = 0;
+}
+
 void HOGPyramid::convolve(const Level & filter, vector<Matrix> & convolutions) const
 {
   convolutions.resize(levels_.size());
@@ -130,6 +304,126 @@ void HOGPyramid::convolve(const Level & filter, vector<Matrix> & convolutions) c
     Convolve(levels_[i], filter, convolutions[i]);
 }
 
+void HOGPyramid::convolve(const vector<const Level *> & filters,
+              vector<vector<Matrix> > & convolutions) const
+{
+  const int nbFilters = static_cast<int>(filters.size());
+  const int nbLevels = static_cast<int>(levels_.size());
+
+  convolutions.resize(nbFilters);
+
+  for (int i = 0; i < nbFilters; ++i)
+    convolutions[i].resize(nbLevels);
+
+#pragma omp parallel for
+  for (int i = 0; i < nbLevels; ++i) {
+    vector<Matrix> tmp(nbFilters);
+
+    for (int j = 0; j < nbFilters; ++j)
+      tmp[j].swap(convolutions[j][i]);
+
+    Convolve(levels_[i], filters, tmp);
+
+    for (int j = 0; j < nbFilters; ++j)
+      tmp[j].swap(convolutions[j][i]);
+  }
+}
+
+void HOGPyramid::convolve(const vector<const Level *> & filters, int level,
+              vector<Matrix> & convolutions) const
+{
+  if ((level < 0) || (level >= levels_.size())) {
+    convolutions.assign(filters.size(), Matrix());
+    return;
+  }
+
+  Convolve(levels_[level], filters, convolutions);
+}
+
+void HOGPyramid::project(const Basis & basis, vector<Matrix> & projections, int first) const
+{
+  projections.resize(levels_.size());
+
+  for (int i = 0; (i < first) && (i < levels_.size()); ++i)
+    projections[i] = Matrix();
+
+#pragma omp parallel for
+  for (int i = max(first, 0); i < levels_.size(); ++i)
+    projections[i] = Project(levels_[i], basis);
+}
+
+HOGPyramid::Basis HOGPyramid::PCA(const vector<Level> & levels, int nbDimensions)
+{
+  nbDimensions = min(max(nbDimensions, 1), NbFeatures);
+
+  // Second moments of the cells
+  Eigen::Matrix<double, NbFeatures, NbFeatures> moments =
+    Eigen::Matrix<double, NbFeatures, NbFeatures>::Zero();
+
+  for (int i = 0; i < levels.size(); ++i) {
+    if (!levels[i].size())
+      continue;
+
+    const Eigen::Map<const Eigen::Matrix<Scalar, Dynamic, NbFeatures, RowMajor> >
+      cells(levels[i].data()->data(), levels[i].size(), NbFeatures);
+
+    moments += (cells.transpose() * cells).cast<double>();
+  }
+
+  // The eigenvalues are sorted in increasing order
+  const Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, NbFeatures, NbFeatures> >
+    solver(moments);
+
+  return solver.eigenvectors().rightCols(nbDimensions).rowwise().reverse().cast<Scalar>();
+}
+
+HOGPyramid::Matrix HOGPyramid::Project(const Level & level, const Basis & basis)
+{
+  Matrix projection(level.rows(), level.cols() * basis.cols());
+
+  if (!level.size())
+    return projection;
+
+  // Each cell is a row of the cell matrix, and the projection stores its coordinates
+  // contiguously as well
+  const Eigen::Map<const Eigen::Matrix<Scalar, Dynamic, NbFeatures, RowMajor> >
+    cells(level.data()->data(), level.size(), NbFeatures);
+
+  Eigen::Map<Matrix>(projection.data(), level.size(), basis.cols()).noalias() = cells * basis;
+
+  return projection;
+}
+
+void HOGPyramid::Convolve(const Matrix & x, const Matrix & y, int nbDimensions, Matrix & z)
+{
+  const int xCols = static_cast<int>(x.cols()) / nbDimensions;
+  const int yCols = static_cast<int>(y.cols()) / nbDimensions;
+
+  // Nothing to do if x is smaller than y
+  if ((x.rows() < y.rows()) || (xCols < yCols) || !y.rows() || !yCols) {
+    z = Matrix();
+    return;
+  }
+
+  const int zRows = static_cast<int>(x.rows() - y.rows()) + 1;
+  const int zCols = xCols - yCols + 1;
+
+  // Same lowering as for the full features, with cells of nbDimensions coordinates
+  const int nbWindows = (zRows - 1) * xCols + zCols;
+
+  Eigen::Matrix<Scalar, Dynamic, 1> sums = Eigen::Matrix<Scalar, Dynamic, 1>::Zero(nbWindows);
+
+  for (int j = 0; j < y.rows(); ++j) {
+    const Eigen::Map<const Matrix, 0, OuterStride<> >
+      windows(x.row(j).data(), nbWindows, y.cols(), OuterStride<>(nbDimensions));
+
+    sums.noalias() += windows * y.row(j).transpose();
+  }
+
+  z = Eigen::Map<const Matrix, 0, OuterStride<> >(sums.data(), zRows, zCols,
+                          OuterStride<>(xCols));
+}
+
 FFLD::HOGPyramid::Level HOGPyramid::Flip(const HOGPyramid::Level & level)
 {
   // Symmetric features
@@ -225,165 +519,522 @@ private:
 };
 
 const HOGTable HOGTable::Singleton_;
+
+// Computes the orientation bins and magnitudes of the gradients of the pixels [begin, end) of a
+// scanline, using for each pixel the channel with the largest gradient magnitude
+static void HogGradients(const uint8_t * linem, const uint8_t * line, const uint8_t * linep,
+             int width, int depth, int begin, int end, int * bins0, int * bins1,
+             HOGPyramid::Scalar * magnitudes0, HOGPyramid::Scalar * magnitudes1)
+{
+  for (int x = begin; x < end; ++x) {
+    // Use the channel with the largest gradient magnitude
+    int maxMagnitude = 0;
+    int argDx = 255;
+    int argDy = 255;
+
+    for (int i = 0; i < depth; ++i) {
+      const int dx = static_cast<int>(line[min(x + 1, width - 1) * depth + i]) -
+               static_cast<int>(line[max(x - 1, 0) * depth + i]);
+      const int dy = static_cast<int>(linep[x * depth + i]) -
+               static_cast<int>(linem[x * depth + i]);
+
+      if (dx * dx + dy * dy > maxMagnitude) {
+        maxMagnitude = dx * dx + dy * dy;
+        argDx = dx + 255;
+        argDy = dy + 255;
+      }
+    }
+
+    bins0[x] = HOGTable::Singleton().bins[argDy][argDx][0];
+    bins1[x] = HOGTable::Singleton().bins[argDy][argDx][1];
+    magnitudes0[x] = HOGTable::Singleton().magnitudes[argDy][argDx][0];
+    magnitudes1[x] = HOGTable::Singleton().magnitudes[argDy][argDx][1];
+  }
 }
+
+#ifdef FFLD_HOGPYRAMID_SIMD
+// Loads one channel of 8 consecutive pixels (depth 1 or 3) into the low half of a register
+__attribute__((target("avx2")))
+static inline __m128i HogLoad8(const uint8_t * pixels, int depth, int channel)
+{
+  if (depth == 1)
+    return _mm_loadl_epi64(reinterpret_cast<const __m128i *>(pixels));
+
+  // Deinterleave the 24 bytes of 8 RGB pixels
+  static const int8_t Shuffles[3][2][16] =
+  {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1}}
+  };
+
+  const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+  const __m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(pixels + 16));
+
+  return _mm_or_si128(
+    _mm_shuffle_epi8(lo, _mm_loadu_si128(reinterpret_cast<const __m128i *>(Shuffles[channel][0]))),
+    _mm_shuffle_epi8(hi, _mm_loadu_si128(reinterpret_cast<const __m128i *>(Shuffles[channel][1]))));
+}
+
+// Loads one channel of 8 consecutive pixels (depth 1 or 3) as floats
+__attribute__((target("avx2")))
+static inline __m256 HogLoad8f(const uint8_t * pixels, int depth, int channel)
+{
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(HogLoad8(pixels, depth, channel)));
 }
 
-void HOGPyramid::Hog(const JPEGImage & image, Level & level, int padx, int pady, int cellSize)
+// Vectorized version of HogGradients (8 pixels at a time). The orientation is computed with a
+// polynomial approximation of atan2 (Cephes atanf) instead of the lookup table, which gives the
+// same soft binning up to float rounding
+__attribute__((target("avx2,fma")))
+static void HogGradientsAVX2(const uint8_t * linem, const uint8_t * line, const uint8_t * linep,
+               int width, int depth, int begin, int end, int * bins0, int * bins1,
+               float * magnitudes0, float * magnitudes1)
+{
+  // Only depths 1 and 3 are vectorized, and the loads must stay within the scanlines
+  const int first = (depth == 1 || depth == 3) ? max(begin, 1) : end;
+  const int last = min(end - 8, width - 9);
+  int x = first;
+
+  HogGradients(linem, line, linep, width, depth, begin, min(first, end), bins0, bins1,
+         magnitudes0, magnitudes1);
+
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+  for (; x <= last; x += 8) {
+    __m256 maxMagnitude = zero;
+    __m256 argDx = zero;
+    __m256 argDy = zero;
+
+    for (int i = 0; i < depth; ++i) {
+      const __m256 dx = _mm256_sub_ps(HogLoad8f(line + (x + 1) * depth, depth, i),
+                      HogLoad8f(line + (x - 1) * depth, depth, i));
+      const __m256 dy = _mm256_sub_ps(HogLoad8f(linep + x * depth, depth, i),
+                      HogLoad8f(linem + x * depth, depth, i));
+      const __m256 magnitude = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+      const __m256 greater = _mm256_cmp_ps(magnitude, maxMagnitude, _CMP_GT_OQ);
+
+      maxMagnitude = _mm256_blendv_ps(maxMagnitude, magnitude, greater);
+      argDx = _mm256_blendv_ps(argDx, dx, greater);
+      argDy = _mm256_blendv_ps(argDy, dy, greater);
+    }
+
+    // atan(min / max) in [0, pi / 4]
+    const __m256 ax = _mm256_andnot_ps(signMask, argDx);
+    const __m256 ay = _mm256_andnot_ps(signMask, argDy);
+    const __m256 num = _mm256_min_ps(ax, ay);
+    const __m256 den = _mm256_max_ps(ax, ay);
+    __m256 a = _mm256_div_ps(num, _mm256_max_ps(den, _mm256_set1_ps(1.0f)));
+    const __m256 reduce = _mm256_cmp_ps(a, _mm256_set1_ps(0.414213562373095f), _CMP_GT_OQ);
+    a = _mm256_blendv_ps(a, _mm256_div_ps(_mm256_sub_ps(a, _mm256_set1_ps(1.0f)),
+                        _mm256_add_ps(a, _mm256_set1_ps(1.0f))), reduce);
+    const __m256 z = _mm256_mul_ps(a, a);
+    __m256 p = _mm256_set1_ps(8.05374449538e-2f);
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-1.38776856032e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.99777106478e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33329491539e-1f));
+    __m256 angle = _mm256_fmadd_ps(_mm256_mul_ps(p, z), a, a);
+    angle = _mm256_add_ps(angle, _mm256_and_ps(reduce, _mm256_set1_ps(0.785398163397448f)));
+
+    // Unfold to [-pi, pi]
+    angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps(1.57079632679490f), angle),
+                 _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps(3.14159265358979f), angle),
+                 _mm256_cmp_ps(argDx, zero, _CMP_LT_OQ));
+    angle = _mm256_xor_ps(angle, _mm256_and_ps(argDy, signMask));
+
+    // Convert it to the range [0, 18)
+    angle = _mm256_fmadd_ps(angle, _mm256_set1_ps(9.0 / M_PI), _mm256_set1_ps(18.0f));
+    angle = _mm256_sub_ps(angle, _mm256_and_ps(_mm256_cmp_ps(angle, _mm256_set1_ps(18.0f),
+                                 _CMP_GE_OQ),
+                           _mm256_set1_ps(18.0f)));
+
+    // Bilinear interpolation
+    const __m256i bin0 = _mm256_cvttps_epi32(angle);
+    const __m256i bin1 = _mm256_and_si256(_mm256_add_epi32(bin0, _mm256_set1_epi32(1)),
+                        _mm256_cmpgt_epi32(_mm256_set1_epi32(17), bin0));
+    const __m256 alpha = _mm256_sub_ps(angle, _mm256_cvtepi32_ps(bin0));
+    const __m256 magnitude = _mm256_mul_ps(_mm256_sqrt_ps(maxMagnitude),
+                         _mm256_set1_ps(1.0f / 255.0f));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(bins0 + x), bin0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(bins1 + x), bin1);
+    _mm256_storeu_ps(magnitudes0 + x, _mm256_fnmadd_ps(magnitude, alpha, magnitude));
+    _mm256_storeu_ps(magnitudes1 + x, _mm256_mul_ps(magnitude, alpha));
+  }
+
+  HogGradients(linem, line, linep, width, depth, max(x, min(first, end)), end, bins0, bins1,
+         magnitudes0, magnitudes1);
+}
+
+// Loads one channel of 16 consecutive pixels (depth 1 or 3) as floats
+__attribute__((target("avx512f")))
+static inline __m512 HogLoad16(const uint8_t * pixels, int depth, int channel)
+{
+  return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+    _mm_unpacklo_epi64(HogLoad8(pixels, depth, channel),
+               HogLoad8(pixels + 8 * depth, depth, channel))));
+}
+
+// Vectorized version of HogGradients (16 pixels at a time), see HogGradientsAVX2
+__attribute__((target("avx512f")))
+static void HogGradientsAVX512(const uint8_t * linem, const uint8_t * line,
+                 const uint8_t * linep, int width, int depth, int begin, int end,
+                 int * bins0, int * bins1, float * magnitudes0, float * magnitudes1)
+{
+  // Only depths 1 and 3 are vectorized, and the loads must stay within the scanlines
+  const int first = (depth == 1 || depth == 3) ? max(begin, 1) : end;
+  const int last = min(end - 16, width - 17);
+  int x = first;
+
+  HogGradients(linem, line, linep, width, depth, begin, min(first, end), bins0, bins1,
+         magnitudes0, magnitudes1);
+
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512i absMask = _mm512_set1_epi32(0x7fffffff);
+  const __m512i signMask = _mm512_set1_epi32(0x80000000);
+
+  for (; x <= last; x += 16) {
+    __m512 maxMagnitude = zero;
+    __m512 argDx = zero;
+    __m512 argDy = zero;
+
+    for (int i = 0; i < depth; ++i) {
+      const __m512 dx = _mm512_sub_ps(HogLoad16(line + (x + 1) * depth, depth, i),
+                      HogLoad16(line + (x - 1) * depth, depth, i));
+      const __m512 dy = _mm512_sub_ps(HogLoad16(linep + x * depth, depth, i),
+                      HogLoad16(linem + x * depth, depth, i));
+      const __m512 magnitude = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+      const __mmask16 greater = _mm512_cmp_ps_mask(magnitude, maxMagnitude, _CMP_GT_OQ);
+
+      maxMagnitude = _mm512_mask_blend_ps(greater, maxMagnitude, magnitude);
+      argDx = _mm512_mask_blend_ps(greater, argDx, dx);
+      argDy = _mm512_mask_blend_ps(greater, argDy, dy);
+    }
+
+    // atan(min / max) in [0, pi / 4]
+    const __m512 ax = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(argDx), absMask));
+    const __m512 ay = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(argDy), absMask));
+    const __m512 num = _mm512_min_ps(ax, ay);
+    const __m512 den = _mm512_max_ps(ax, ay);
+    __m512 a = _mm512_div_ps(num, _mm512_max_ps(den, _mm512_set1_ps(1.0f)));
+    const __mmask16 reduce = _mm512_cmp_ps_mask(a, _mm512_set1_ps(0.414213562373095f),
+                          _CMP_GT_OQ);
+    a = _mm512_mask_div_ps(a, reduce, _mm512_sub_ps(a, _mm512_set1_ps(1.0f)),
+                 _mm512_add_ps(a, _mm512_set1_ps(1.0f)));
+    const __m512 z = _mm512_mul_ps(a, a);
+    __m512 p = _mm512_set1_ps(8.05374449538e-2f);
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(-1.38776856032e-1f));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(1.99777106478e-1f));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(-3.33329491539e-1f));
+    __m512 angle = _mm512_fmadd_ps(_mm512_mul_ps(p, z), a, a);
+    angle = _mm512_mask_add_ps(angle, reduce, angle, _mm512_set1_ps(0.785398163397448f));
+
+    // Unfold to [-pi, pi]
+    angle = _mm512_mask_sub_ps(angle, _mm512_cmp_ps_mask(ay, ax, _CMP_GT_OQ),
+                   _mm512_set1_ps(1.57079632679490f), angle);
+    angle = _mm512_mask_sub_ps(angle, _mm512_cmp_ps_mask(argDx, zero, _CMP_LT_OQ),
+                   _mm512_set1_ps(3.14159265358979f), angle);
+    angle = _mm512_castsi512_ps(_mm512_xor_epi32(_mm512_castps_si512(angle),
+                           _mm512_and_epi32(_mm512_castps_si512(argDy),
+                                    signMask)));
+
+    // Convert it to the range [0, 18)
+    angle = _mm512_fmadd_ps(angle, _mm512_set1_ps(9.0 / M_PI), _mm512_set1_ps(18.0f));
+    angle = _mm512_mask_sub_ps(angle, _mm512_cmp_ps_mask(angle, _mm512_set1_ps(18.0f),
+                               _CMP_GE_OQ),
+                   angle, _mm512_set1_ps(18.0f));
+
+    // Bilinear interpolation
+    const __m512i bin0 = _mm512_cvttps_epi32(angle);
+    const __m512i bin1 = _mm512_maskz_add_epi32(_mm512_cmplt_epi32_mask(bin0,
+                                      _mm512_set1_epi32(17)),
+                          bin0, _mm512_set1_epi32(1));
+    const __m512 alpha = _mm512_sub_ps(angle, _mm512_cvtepi32_ps(bin0));
+    const __m512 magnitude = _mm512_mul_ps(_mm512_sqrt_ps(maxMagnitude),
+                         _mm512_set1_ps(1.0f / 255.0f));
+
+    _mm512_storeu_si512(bins0 + x, bin0);
+    _mm512_storeu_si512(bins1 + x, bin1);
+    _mm512_storeu_ps(magnitudes0 + x, _mm512_fnmadd_ps(magnitude, alpha, magnitude));
+    _mm512_storeu_ps(magnitudes1 + x, _mm512_mul_ps(magnitude, alpha));
+  }
+
+  HogGradients(linem, line, linep, width, depth, max(x, min(first, end)), end, bins0, bins1,
+         magnitudes0, magnitudes1);
+}
+#endif
+
+// Type of the functions computing the gradients of a scanline
+typedef void (*HogGradientsKernel)(const uint8_t *, const uint8_t *, const uint8_t *, int, int,
+                   int, int, int *, int *, HOGPyramid::Scalar *,
+                   HOGPyramid::Scalar *);
+
+// Selects the fastest implementation supported by the CPU at runtime
+static HogGradientsKernel SelectHogGradients()
+{
+#ifdef FFLD_HOGPYRAMID_SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f"))
+    return HogGradientsAVX512;
+
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return HogGradientsAVX2;
+#endif
+  return HogGradients;
+}
+
+static const HogGradientsKernel HogGradientsDispatch = SelectHogGradients();
+}
+}
+
+void HOGPyramid::HogAccumulate(const uint8_t * linem, const uint8_t * line, const uint8_t * linep,
+                int width, int depth, int y, const int * bins0, const int * bins1,
+                const Scalar * magnitudes0, const Scalar * magnitudes1, Level & level,
+                int padx, int pady, int cellSize)
+{
+  const Scalar invCellSize = static_cast<Scalar>(1) / cellSize;
+
+  for (int x = 0; x < width; ++x) {
+    const int bin0 = bins0[x];
+    const int bin1 = bins1[x];
+    const Scalar magnitude0 = magnitudes0[x];
+    const Scalar magnitude1 = magnitudes1[x];
+
+    // Bilinear interpolation
+    const Scalar xp = (x + static_cast<Scalar>(0.5)) * invCellSize + padx - 0.5f;
+    const Scalar yp = (y + static_cast<Scalar>(0.5)) * invCellSize + pady - 0.5f;
+    const int ixp = xp;
+    const int iyp = yp;
+    const Scalar xp0 = xp - ixp;
+    const Scalar yp0 = yp - iyp;
+    const Scalar xp1 = 1 - xp0;
+    const Scalar yp1 = 1 - yp0;
+
+    level(iyp    , ixp    )(bin0) += xp1 * yp1 * magnitude0;
+    level(iyp    , ixp    )(bin1) += xp1 * yp1 * magnitude1;
+    level(iyp    , ixp + 1)(bin0) += xp0 * yp1 * magnitude0;
+    level(iyp    , ixp + 1)(bin1) += xp0 * yp1 * magnitude1;
+    level(iyp + 1, ixp    )(bin0) += xp1 * yp0 * magnitude0;
+    level(iyp + 1, ixp    )(bin1) += xp1 * yp0 * magnitude1;
+    level(iyp + 1, ixp + 1)(bin0) += xp0 * yp0 * magnitude0;
+    level(iyp + 1, ixp + 1)(bin1) += xp0 * yp0 * magnitude1;
+
+#ifdef FFLD_HOGPYRAMID_EXTRA_FEATURES
+    // Normalize by the number of pixels
+    const Scalar normalization = 2.0 / (cellSize * cellSize);
+
+    // Texture (Uniform LBP) features
+    const int LBP_TABLE[256] =
+    {
+      0, 1, 1, 2, 1, 9, 2, 3, 1, 9, 9, 9, 2, 9, 3, 4, 1, 9, 9, 9, 9, 9, 9, 9,
+      2, 9, 9, 9, 3, 9, 4, 5, 1, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+      2, 9, 9, 9, 9, 9, 9, 9, 3, 9, 9, 9, 4, 9, 5, 6, 1, 9, 9, 9, 9, 9, 9, 9,
+      9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+      2, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 3, 9, 9, 9, 9, 9, 9, 9,
+      4, 9, 9, 9, 5, 9, 6, 7, 1, 2, 9, 3, 9, 9, 9, 4, 9, 9, 9, 9, 9, 9, 9, 5,
+      9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 9,
+      9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 7,
+      2, 3, 9, 4, 9, 9, 9, 5, 9, 9, 9, 9, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 9,
+      9, 9, 9, 9, 9, 9, 9, 7, 3, 4, 9, 5, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 7,
+      4, 5, 9, 6, 9, 9, 9, 7, 5, 6, 9, 7, 6, 7, 7, 8
+    };
+
+    // Use the green channel if available
+    const uint8_t g = line[x * depth + (depth > 1)];
+
+    const int lbp = (static_cast<int>(linem[xm * depth + (depth > 1)] >= g)     ) |
+            (static_cast<int>(linem[x  * depth + (depth > 1)] >= g) << 1) |
+            (static_cast<int>(linem[xp * depth + (depth > 1)] >= g) << 2) |
+            (static_cast<int>(line[ xp * depth + (depth > 1)] >= g) << 3) |
+            (static_cast<int>(linep[xp * depth + (depth > 1)] >= g) << 4) |
+            (static_cast<int>(linep[x  * depth + (depth > 1)] >= g) << 5) |
+            (static_cast<int>(linep[xm * depth + (depth > 1)] >= g) << 6) |
+            (static_cast<int>(line[ xm * depth + (depth > 1)] >= g) << 7);
+
+    // Bilinear interpolation
+    level(iyp    , ixp    )(LBP_TABLE[lbp] + 31) += xp1 * yp1 * normalization;
+    level(iyp    , ixp + 1)(LBP_TABLE[lbp] + 31) += xp0 * yp1 * normalization;
+    level(iyp + 1, ixp    )(LBP_TABLE[lbp] + 31) += xp1 * yp0 * normalization;
+    level(iyp + 1, ixp + 1)(LBP_TABLE[lbp] + 31) += xp0 * yp0 * normalization;
+
+    // Color features
+    if (depth >= 3) {
+      const Scalar r = line[x * depth + 0] * static_cast<Scalar>(1.0 / 255.0);
+      const Scalar g = line[x * depth + 1] * static_cast<Scalar>(1.0 / 255.0);
+      const Scalar b = line[x * depth + 2] * static_cast<Scalar>(1.0 / 255.0);
+
+      const Scalar minRGB = min(r, min(g, b));
+      const Scalar maxRGB = max(r, max(g, b));
+      const Scalar chroma = maxRGB - minRGB;
+
+      if (chroma > 0.05) {
+        Scalar hue = 0;
+
+        if (r == maxRGB)
+          hue = (g - b) / chroma;
+        else if (g == maxRGB)
+          hue = (b - r) / chroma + 2;
+        else
+          hue = (r - g) / chroma + 4;
+
+        if (hue < 0)
+          hue += 6;
+        else if (hue >= 6)
+          hue = 0;
+
+        const Scalar saturation = chroma / maxRGB;
+
+        // Bilinear interpolation
+        const int bin0 = hue;
+        const int bin1 = (hue0 < 5) ? (hue0 + 1) : 0;
+        const Scalar alpha = hue - bin0;
+        const Scalar magnitude0 = saturation * normalization * (1 - alpha);
+        const Scalar magnitude1 = saturation * normalization * alpha;
+
+        level(iyp    , ixp    )(bin0 + 41) += xp1 * yp1 * magnitude0;
+        level(iyp    , ixp    )(bin1 + 41) += xp1 * yp1 * magnitude1;
+        level(iyp    , ixp + 1)(bin0 + 41) += xp0 * yp1 * magnitude0;
+        level(iyp    , ixp + 1)(bin1 + 41) += xp0 * yp1 * magnitude1;
+        level(iyp + 1, ixp    )(bin0 + 41) += xp1 * yp0 * magnitude0;
+        level(iyp + 1, ixp    )(bin1 + 41) += xp1 * yp0 * magnitude1;
+        level(iyp + 1, ixp + 1)(bin0 + 41) += xp0 * yp0 * magnitude0;
+        level(iyp + 1, ixp + 1)(bin1 + 41) += xp0 * yp0 * magnitude1;
+      }
+    }
+#endif
+  }
+}
+
+void HOGPyramid::HogHistograms(const ImageResampler & source, Level & level, int padx, int pady,
+                 int cellSize, Level * coarse, JPEGImage * half, int begin, int end)
+{
+  const int width = source.width();
+  const int height = source.height();
+  const int depth = source.depth();
+
+  // Orientation bins and magnitudes of the gradients of the current scanline, and the last three
+  // rescaled scanlines (kept from one call to the next by each thread)
+  static thread_local vector<int> bins0;
+  static thread_local vector<int> bins1;
+  static thread_local vector<Scalar> magnitudes0;
+  static thread_local vector<Scalar> magnitudes1;
+  static thread_local vector<uint8_t> lines[3];
+  static thread_local vector<float> row;
+
+  if (bins0.size() < width) {
+    bins0.resize(width);
+    bins1.resize(width);
+    magnitudes0.resize(width);
+    magnitudes1.resize(width);
+  }
+
+  for (int i = 0; i < 3; ++i)
+    if (lines[i].size() < width * depth)
+      lines[i].resize(width * depth);
+
+  // The scanline of index y is stored in lines[y % 3]
+  const uint8_t * linem = source.scanLine(max(begin - 1, 0), &lines[max(begin - 1, 0) % 3][0],
+                      row);
+  const uint8_t * line = source.scanLine(begin, &lines[begin % 3][0], row);
+
+  for (int y = begin; y < end; ++y) {
+    const uint8_t * linep = (y + 1 < height) ?
+                source.scanLine(y + 1, &lines[(y + 1) % 3][0], row) : line;
+
+    detail::HogGradientsDispatch(linem, line, linep, width, depth, 0, width, &bins0[0],
+                   &bins1[0], &magnitudes0[0], &magnitudes1[0]);
+
+    HogAccumulate(linem, line, linep, width, depth, y, &bins0[0], &bins1[0], &magnitudes0[0],
+            &magnitudes1[0], level, padx, pady, cellSize);
+
+    if (coarse)
+      HogAccumulate(linem, line, linep, width, depth, y, &bins0[0], &bins1[0],
+              &magnitudes0[0], &magnitudes1[0], *coarse, padx, pady, 2 * cellSize);
+
+    // Half scale image (same as ImageView::rescale(0.5)), from the scanlines y - 1 and y if y is
+    // odd, or from the last scanline alone
+    if (half && ((y & 1) || (y == height - 1))) {
+      const uint8_t * line0 = (y & 1) ? linem : line;
+      uint8_t * result = half->scanLine(y / 2);
+
+      for (int j = 0; j < half->width(); ++j) {
+        const int j2 = min(2 * j + 1, width - 1);
+
+        for (int k = 0; k < depth; ++k)
+          result[j * depth + k] = (2 + line0[2 * j * depth + k] + line0[j2 * depth + k] +
+                          line[2 * j * depth + k] + line[j2 * depth + k]) >> 2;
+      }
+    }
+
+    linem = line;
+    line = linep;
+  }
+}
+
+void HOGPyramid::Hog(const ImageView & image, Level & level, int padx, int pady, int cellSize)
+{
+  Hog(ImageResampler(image, 1.0), level, padx, pady, cellSize);
+}
+
+void HOGPyramid::Hog(const ImageResampler & source, Level & level, int padx, int pady,
+           int cellSize, Level * coarse, JPEGImage * half)
 {
   // Get all the image members
-  const int width = image.width();
-  const int height = image.height();
-  const int depth = image.depth();
+  const int width = source.width();
+  const int height = source.height();
+  const int depth = source.depth();
 
   // Make sure the image is big enough
   if ((width < cellSize) || (height < cellSize) || (depth < 1) || (padx < 1) || (pady < 1) ||
-    (cellSize < 1)) {
-    level.swap(Level());
+    (cellSize < 1) || (coarse && ((width < 2 * cellSize) || (height < 2 * cellSize)))) {
+    level = Level();
+
+    if (coarse)
+      *coarse = Level();
+
     cerr << "Attempting to compute an empty pyramid level" << endl;
     return;
   }
 
-  // Resize the feature matrix
+  // Resize the feature matrices
   level = Level::Constant((height + cellSize / 2) / cellSize + 2 * pady,
               (width + cellSize / 2) / cellSize + 2 * padx, Cell::Zero());
 
-  const Scalar invCellSize = static_cast<Scalar>(1) / cellSize;
+  if (coarse)
+    *coarse = Level::Constant((height + cellSize) / (2 * cellSize) + 2 * pady,
+                  (width + cellSize) / (2 * cellSize) + 2 * padx, Cell::Zero());
 
-  for (int y = 0; y < height; ++y) {
-    const uint8_t * linem = image.scanLine(max(y - 1, 0));
-    const uint8_t * line = image.scanLine(y);
-    const uint8_t * linep = image.scanLine(min(y + 1, height - 1));
-
-    for (int x = 0; x < width; ++x) {
-      // Use the channel with the largest gradient magnitude
-      int maxMagnitude = 0;
-      int argDx = 255;
-      int argDy = 255;
-
-      for (int i = 0; i < depth; ++i) {
-        const int dx = static_cast<int>(line[min(x + 1, width - 1) * depth + i]) -
-                 static_cast<int>(line[max(x - 1, 0) * depth + i]);
-        const int dy = static_cast<int>(linep[x * depth + i]) -
-                 static_cast<int>(linem[x * depth + i]);
-
-        if (dx * dx + dy * dy > maxMagnitude) {
-          maxMagnitude = dx * dx + dy * dy;
-          argDx = dx + 255;
-          argDy = dy + 255;
-        }
-      }
+  if (half)
+    half->resize((width + 1) / 2, (height + 1) / 2, depth);
 
-      const char bin0 = detail::HOGTable::Singleton().bins[argDy][argDx][0];
-      const char bin1 = detail::HOGTable::Singleton().bins[argDy][argDx][1];
-      const Scalar magnitude0 = detail::HOGTable::Singleton().magnitudes[argDy][argDx][0];
-      const Scalar magnitude1 = detail::HOGTable::Singleton().magnitudes[argDy][argDx][1];
+  // Compute the histograms by bands of two cells (in pixels) of the coarsest level. Bands of the
+  // same parity never write to the same cells and can thus be processed concurrently
+  const int bandSize = (coarse ? 4 : 2) * cellSize;
+  const int nbBands = (height + bandSize - 1) / bandSize;
 
-      // Bilinear interpolation
-      const Scalar xp = (x + static_cast<Scalar>(0.5)) * invCellSize + padx - 0.5f;
-      const Scalar yp = (y + static_cast<Scalar>(0.5)) * invCellSize + pady - 0.5f;
-      const int ixp = xp;
-      const int iyp = yp;
-      const Scalar xp0 = xp - ixp;
-      const Scalar yp0 = yp - iyp;
-      const Scalar xp1 = 1 - xp0;
-      const Scalar yp1 = 1 - yp0;
-
-      level(iyp    , ixp    )(bin0) += xp1 * yp1 * magnitude0;
-      level(iyp    , ixp    )(bin1) += xp1 * yp1 * magnitude1;
-      level(iyp    , ixp + 1)(bin0) += xp0 * yp1 * magnitude0;
-      level(iyp    , ixp + 1)(bin1) += xp0 * yp1 * magnitude1;
-      level(iyp + 1, ixp    )(bin0) += xp1 * yp0 * magnitude0;
-      level(iyp + 1, ixp    )(bin1) += xp1 * yp0 * magnitude1;
-      level(iyp + 1, ixp + 1)(bin0) += xp0 * yp0 * magnitude0;
-      level(iyp + 1, ixp + 1)(bin1) += xp0 * yp0 * magnitude1;
+  for (int parity = 0; parity < 2; ++parity) {
+#pragma omp parallel for
+    for (int band = parity; band < nbBands; band += 2)
+      HogHistograms(source, level, padx, pady, cellSize, coarse, half, band * bandSize,
+              min((band + 1) * bandSize, height));
+  }
 
-#ifdef FFLD_HOGPYRAMID_EXTRA_FEATURES
-      // Normalize by the number of pixels
-      const Scalar normalization = 2.0 / (cellSize * cellSize);
-
-      // Texture (Uniform LBP) features
-      const int LBP_TABLE[256] =
-      {
-        0, 1, 1, 2, 1, 9, 2, 3, 1, 9, 9, 9, 2, 9, 3, 4, 1, 9, 9, 9, 9, 9, 9, 9,
-        2, 9, 9, 9, 3, 9, 4, 5, 1, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
-        2, 9, 9, 9, 9, 9, 9, 9, 3, 9, 9, 9, 4, 9, 5, 6, 1, 9, 9, 9, 9, 9, 9, 9,
-        9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
-        2, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 3, 9, 9, 9, 9, 9, 9, 9,
-        4, 9, 9, 9, 5, 9, 6, 7, 1, 2, 9, 3, 9, 9, 9, 4, 9, 9, 9, 9, 9, 9, 9, 5,
-        9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 9,
-        9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 7,
-        2, 3, 9, 4, 9, 9, 9, 5, 9, 9, 9, 9, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 9,
-        9, 9, 9, 9, 9, 9, 9, 7, 3, 4, 9, 5, 9, 9, 9, 6, 9, 9, 9, 9, 9, 9, 9, 7,
-        4, 5, 9, 6, 9, 9, 9, 7, 5, 6, 9, 7, 6, 7, 7, 8
-      };
-
-      // Use the green channel if available
-      const uint8_t g = line[x * depth + (depth > 1)];
-
-      const int lbp = (static_cast<int>(linem[xm * depth + (depth > 1)] >= g)     ) |
-              (static_cast<int>(linem[x  * depth + (depth > 1)] >= g) << 1) |
-              (static_cast<int>(linem[xp * depth + (depth > 1)] >= g) << 2) |
-              (static_cast<int>(line[ xp * depth + (depth > 1)] >= g) << 3) |
-              (static_cast<int>(linep[xp * depth + (depth > 1)] >= g) << 4) |
-              (static_cast<int>(linep[x  * depth + (depth > 1)] >= g) << 5) |
-              (static_cast<int>(linep[xm * depth + (depth > 1)] >= g) << 6) |
-              (static_cast<int>(line[ xm * depth + (depth > 1)] >= g) << 7);
+  HogNormalize(level, padx, pady);
 
-      // Bilinear interpolation
-      level(iyp    , ixp    )(LBP_TABLE[lbp] + 31) += xp1 * yp1 * normalization;
-      level(iyp    , ixp + 1)(LBP_TABLE[lbp] + 31) += xp0 * yp1 * normalization;
-      level(iyp + 1, ixp    )(LBP_TABLE[lbp] + 31) += xp1 * yp0 * normalization;
-      level(iyp + 1, ixp + 1)(LBP_TABLE[lbp] + 31) += xp0 * yp0 * normalization;
-
-      // Color features
-      if (depth >= 3) {
-        const Scalar r = line[x * depth + 0] * static_cast<Scalar>(1.0 / 255.0);
-        const Scalar g = line[x * depth + 1] * static_cast<Scalar>(1.0 / 255.0);
-        const Scalar b = line[x * depth + 2] * static_cast<Scalar>(1.0 / 255.0);
-
-        const Scalar minRGB = min(r, min(g, b));
-        const Scalar maxRGB = max(r, max(g, b));
-        const Scalar chroma = maxRGB - minRGB;
-
-        if (chroma > 0.05) {
-          Scalar hue = 0;
-
-          if (r == maxRGB)
-            hue = (g - b) / chroma;
-          else if (g == maxRGB)
-            hue = (b - r) / chroma + 2;
-          else
-            hue = (r - g) / chroma + 4;
-
-          if (hue < 0)
-            hue += 6;
-          else if (hue >= 6)
-            hue = 0;
-
-          const Scalar saturation = chroma / maxRGB;
-
-          // Bilinear interpolation
-          const int bin0 = hue;
-          const int bin1 = (hue0 < 5) ? (hue0 + 1) : 0;
-          const Scalar alpha = hue - bin0;
-          const Scalar magnitude0 = saturation * normalization * (1 - alpha);
-          const Scalar magnitude1 = saturation * normalization * alpha;
-
-          level(iyp    , ixp    )(bin0 + 41) += xp1 * yp1 * magnitude0;
-          level(iyp    , ixp    )(bin1 + 41) += xp1 * yp1 * magnitude1;
-          level(iyp    , ixp + 1)(bin0 + 41) += xp0 * yp1 * magnitude0;
-          level(iyp    , ixp + 1)(bin1 + 41) += xp0 * yp1 * magnitude1;
-          level(iyp + 1, ixp    )(bin0 + 41) += xp1 * yp0 * magnitude0;
-          level(iyp + 1, ixp    )(bin1 + 41) += xp1 * yp0 * magnitude1;
-          level(iyp + 1, ixp + 1)(bin0 + 41) += xp0 * yp0 * magnitude0;
-          level(iyp + 1, ixp + 1)(bin1 + 41) += xp0 * yp0 * magnitude1;
-        }
-      }
-#endif
-    }
-  }
+  if (coarse)
+    HogNormalize(*coarse, padx, pady);
+}
 
+void HOGPyramid::HogNormalize(Level & level, int padx, int pady)
+{
   // Compute the "gradient energy" of each cell, i.e. ||C(i,j)||^2
+#pragma omp parallel for
   for (int y = 0; y < level.rows(); ++y) {
     for (int x = 0; x < level.cols(); ++x) {
       Scalar sumSq = 0;
@@ -399,6 +1050,8 @@ void HOGPyramid::Hog(const JPEGImage & image, Level & level, int padx, int pady,
   // Compute the four normalization factors then normalize and clamp everything
   const Scalar EPS = numeric_limits<Scalar>::epsilon();
 
+  // Each row only reads the energies of its neighbors, which are not modified
+#pragma omp parallel for
   for (int y = pady; y < level.rows() - pady; ++y) {
     for (int x = padx; x < level.cols() - padx; ++x) {
       const Scalar n0 = 1 / sqrt(level(y - 1, x - 1)(NbFeatures - 1) +
@@ -456,6 +1109,7 @@ void HOGPyramid::Hog(const JPEGImage & image, Level & level, int padx, int pady,
   }
 
   // Truncation features
+#pragma omp parallel for
   for (int y = 0; y < level.rows(); ++y) {
     for (int x = 0; x < level.cols(); ++x) {
       if ((y < pady) || (y >= level.rows() - pady) || (x < padx) ||
@@ -470,10 +1124,85 @@ void HOGPyramid::Hog(const JPEGImage & image, Level & level, int padx, int pady,
   }
 }
 
+void HOGPyramid::trim(const vector<bool> & needed, int lastLevel, Workspace * workspace)
+{
+  if (workspace && (workspace->levels_.size() < levels_.size()))
+    workspace->levels_.resize(levels_.size());
+
+  for (int z = 0; z < levels_.size(); ++z) {
+    if ((z <= lastLevel) && (z < needed.size()) && needed[z])
+      continue;
+
+    if (workspace)
+      workspace->levels_[z].swap(levels_[z]);
+
+    levels_[z] = Level();
+  }
+
+  levels_.resize(lastLevel + 1);
+}
+
+int HOGPyramid::NearestComputed(int z, int interval, int maxLevel)
+{
+  int nearest = (z / interval + (2 * (z % interval) > interval)) * interval;
+
+  if (nearest > maxLevel)
+    nearest -= interval;
+
+  return nearest;
+}
+
+void HOGPyramid::Approximate(const Level & level, Level & result, int rows, int cols,
+               double ratio, int padx, int pady)
+{
+  const int srcRows = static_cast<int>(level.rows()) - 2 * pady;
+  const int srcCols = static_cast<int>(level.cols()) - 2 * padx;
+
+  if ((srcRows < 1) || (srcCols < 1) || (rows < 1) || (cols < 1) || (ratio <= 0.0)) {
+    result = Level();
+    cerr << "Attempting to compute an empty pyramid level" << endl;
+    return;
+  }
+
+  result = Level::Constant(rows + 2 * pady, cols + 2 * padx, Cell::Zero());
+
+  // Power law correction of the feature energy across scales. The exponent was measured on the
+  // normalized features of successive exact levels (they grow as ~scale^-0.15)
+  const Scalar correction = pow(ratio, -0.15);
+
+  for (int y = 0; y < rows; ++y) {
+    const double ys = min(max((y + 0.5) / ratio - 0.5, 0.0), srcRows - 1.0);
+    const int y0 = ys;
+    const int y1 = min(y0 + 1, srcRows - 1);
+    const Scalar c = ys - y0;
+
+    for (int x = 0; x < cols; ++x) {
+      const double xs = min(max((x + 0.5) / ratio - 0.5, 0.0), srcCols - 1.0);
+      const int x0 = xs;
+      const int x1 = min(x0 + 1, srcCols - 1);
+      const Scalar a = xs - x0;
+
+      // Bilinear interpolation
+      result(y + pady, x + padx) =
+        ((level(y0 + pady, x0 + padx) * (1 - a) + level(y0 + pady, x1 + padx) * a) * (1 - c) +
+         (level(y1 + pady, x0 + padx) * (1 - a) + level(y1 + pady, x1 + padx) * a) * c) *
+        correction;
+
+      result(y + pady, x + padx)(NbFeatures - 1) = 0;
+    }
+  }
+
+  // Truncation features
+  for (int y = 0; y < result.rows(); ++y)
+    for (int x = 0; x < result.cols(); ++x)
+      if ((y < pady) || (y >= result.rows() - pady) || (x < padx) || (x >= result.cols() - padx))
+        result(y, x)(NbFeatures - 1) = 1;
+}
+
 void HOGPyramid::Convolve(const Level & x, const Level & y, Matrix & z)
 {
   // Nothing to do if x is smaller than y
-  if ((x.rows() < y.rows()) || (x.cols() < y.cols())) {
+  if ((x.rows() < y.rows()) || (x.cols() < y.cols()) || !y.rows() || !y.cols()) {
     z = Matrix();
     return;
   }
@@ -497,6 +1226,90 @@ void HOGPyramid::Convolve(const Level & x, const Level & y, Matrix & z)
   }
 }
 
+void HOGPyramid::Convolve(const Level & x, const vector<const Level *> & y, vector<Matrix> & z)
+{
+  const int nbFilters = static_cast<int>(y.size());
+
+  z.resize(nbFilters);
+
+#ifndef FFLD_NATIVE_ARCH
+  // Without AVX the matrix products below are not faster than the per-row products of one filter
+  // at a time
+  for (int i = 0; i < nbFilters; ++i)
+    Convolve(x, *y[i], z[i]);
+#else
+  // Group the filters of the same size
+  vector<bool> done(nbFilters, false);
+
+  for (int i = 0; i < nbFilters; ++i) {
+    if (done[i])
+      continue;
+
+    const int rows = static_cast<int>(y[i]->rows());
+    const int cols = static_cast<int>(y[i]->cols());
+
+    vector<int> group;
+
+    for (int j = i; j < nbFilters; ++j) {
+      if (!done[j] && (y[j]->rows() == rows) && (y[j]->cols() == cols)) {
+        group.push_back(j);
+        done[j] = true;
+      }
+    }
+
+    // Small groups are faster convolved one filter at a time (matrix-vector products), as the
+    // packing of the windows done by the matrix-matrix products is then not amortized
+    if (group.size() < 8) {
+      for (int j = 1; j < group.size(); ++j)
+        done[group[j]] = false;
+
+      group.resize(1);
+    }
+
+    const int nbGroup = static_cast<int>(group.size());
+
+    // Nothing to do if x is smaller than the filters
+    if ((x.rows() < rows) || (x.cols() < cols) || !rows || !cols) {
+      for (int j = 0; j < nbGroup; ++j)
+        z[group[j]] = Matrix();
+
+      continue;
+    }
+
+    const int zRows = static_cast<int>(x.rows()) - rows + 1;
+    const int zCols = static_cast<int>(x.cols()) - cols + 1;
+
+    // Each filter row is multiplied with the windows of cols cells starting at every cell of the
+    // level, mapped directly over its row-major storage (im2col without copy), so that all the
+    // filters of the group are applied by a single matrix product. The windows wrapping around
+    // the right border are computed and discarded, which is cheaper than one product per output
+    // row
+    const int nbWindows = (zRows - 1) * static_cast<int>(x.cols()) + zCols;
+
+    Eigen::Matrix<Scalar, Dynamic, Dynamic> sums =
+      Eigen::Matrix<Scalar, Dynamic, Dynamic>::Zero(nbWindows, nbGroup);
+    Eigen::Matrix<Scalar, Dynamic, Dynamic> weights(cols * NbFeatures, nbGroup);
+
+    for (int j = 0; j < rows; ++j) {
+      for (int k = 0; k < nbGroup; ++k)
+        weights.col(k) = Eigen::Map<const Eigen::Matrix<Scalar, Dynamic, 1>, Aligned>(
+                   reinterpret_cast<const Scalar *>(y[group[k]]->row(j).data()),
+                   cols * NbFeatures);
+
+      const Eigen::Map<const Matrix, Aligned, OuterStride<NbFeatures> >
+        windows(reinterpret_cast<const Scalar *>(x.row(j).data()), nbWindows,
+            cols * NbFeatures);
+
+      sums.noalias() += windows * weights;
+    }
+
+    for (int k = 0; k < nbGroup; ++k)
+      z[group[k]] = Eigen::Map<const Matrix, 0, OuterStride<> >(sums.col(k).data(), zRows, zCols,
+                                    OuterStride<>(x.cols()));
+  }
+#endif
+}
+
 ostream & FFLD::operator<<(ostream & os, const HOGPyramid & pyramid)
 {
   os << pyramid.padx() << ' ' << pyramid.pady() << ' ' << pyramid.interval() << ' '
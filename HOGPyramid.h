@@ -37,6 +37,8 @@ namespace FFLD
 /// uses twice the amount of memory, and the increase in precision is not necessarily useful).
 /// @note Define the FFLD_HOGPYRAMID_EXTRA_FEATURES to add extra texture (uniform LBP) and color
 /// (hue histogram) features in addition to the original HOG features.
+/// @note The gradients are computed by AVX2 or AVX-512 kernels if the CPU supports them (selected
+/// at runtime). Define FFLD_HOGPYRAMID_SCALAR to always use the scalar implementation.
 class HOGPyramid
 {
 public:
@@ -64,16 +66,55 @@ public:
   /// Type of a pyramid level (matrix of cells).
   typedef Eigen::Matrix<Cell, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Level;
 
+  /// Type of a basis of a subspace of the features (one vector per column, see PCA()).
+  typedef Eigen::Matrix<Scalar, NbFeatures, Eigen::Dynamic> Basis;
+
+  /// The Workspace class keeps the memory used to construct pyramids (rescaled images and
+  /// levels) so that it can be reused from one image to the next.
+  /// @note The rescaled images never release their memory, while the levels are reused as long as
+  /// their size does not change (Eigen matrices cannot hold more memory than they need). The levels
+  /// a pyramid does not need (outside of its scale range) stay in the workspace. Hence constructing
+  /// successive pyramids of images of the same size does not allocate any memory, whatever their
+  /// scale ranges.
+  /// @note A workspace must not be used by several pyramid constructions concurrently.
+  class Workspace
+  {
+  public:
+    /// Constructs an empty workspace.
+    Workspace();
+
+  private:
+    std::vector<JPEGImage> images_;
+    std::vector<Level> levels_;
+
+    friend class HOGPyramid;
+  };
+
   /// Constructs an empty pyramid. An empty pyramid has no level.
   HOGPyramid();
 
-  /// Constructs a pyramid from the JPEGImage of a Scene.
-  /// @param[in] image The JPEGImage of the Scene.
+  /// Constructs a pyramid from an image.
+  /// @param[in] image The image (a JPEGImage, or a view of pixels stored elsewhere which are not
+  /// copied).
   /// @param[in] padx Amount of horizontal zero padding (in cells).
   /// @param[in] pady Amount of vertical zero padding (in cells).
   /// @param[in] interval Number of levels per octave in the pyramid.
+  /// @param[in] approximate Whether to compute only one level per octave and to approximate the
+  /// others by resampling the nearest computed level in feature space (faster by a factor of about
+  /// @p interval, but less accurate).
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// constructions (see release()).
+  /// @param[in] minScale Smallest scale of the levels to compute.
+  /// @param[in] maxScale Largest scale of the levels to compute.
   /// @note The amount of padding and the interval should be at least 1.
-  HOGPyramid(const JPEGImage & image, int padx, int pady, int interval = 5);
+  /// @note Only the levels of scale between @p minScale and @p maxScale (plus the nearest level
+  /// outside of each bound) are computed, together with the levels one octave above them (at twice
+  /// the scale) as they are needed by the parts of the models. The other levels are left empty,
+  /// except those below the range which are removed, so that the index of a level (hence its
+  /// scale) does not depend on the range. The default range contains all the levels.
+  HOGPyramid(const ImageView & image, int padx, int pady, int interval = 5,
+         bool approximate = false, Workspace * workspace = 0, double minScale = 0.0,
+         double maxScale = 2.0);
 
   /// Constructs a pyramid from parameters and a list of levels.
   /// @param[in] padx Amount of horizontal zero padding (in cells).
@@ -98,13 +139,59 @@ public:
 
   /// Returns the pyramid levels.
   /// @note Scales are given by the following formula: 2^(1 - @c index / @c interval).
+  /// @note Levels outside of the scale range given at construction are empty.
   const std::vector<Level> & levels() const;
 
+  /// Empties the pyramid and gives the memory of its levels back to a @p workspace, so that it
+  /// can be reused by the construction of the next pyramid.
+  void release(Workspace & workspace);
+
   /// Returns the convolutions of the pyramid with a filter.
   /// @param[in] filter Filter.
   /// @param[out] convolutions Convolution of each level.
   void convolve(const Level & filter, std::vector<Matrix> & convolutions) const;
 
+  /// Returns the convolutions of the pyramid with several filters at once.
+  /// @param[in] filters Filters (not copied).
+  /// @param[out] convolutions Convolution of each filter and each level.
+  /// @note When compiled with FFLD_NATIVE_ARCH the filters of the same size are lowered into a
+  /// single matrix product per level, which is only faster than one filter at a time with AVX.
+  void convolve(const std::vector<const Level *> & filters,
+          std::vector<std::vector<Matrix> > & convolutions) const;
+
+  /// Returns the convolutions of a single level of the pyramid with several filters at once.
+  /// @param[in] filters Filters (not copied).
+  /// @param[in] level Index of the level.
+  /// @param[out] convolutions Convolution of the level with each filter (empty if the filter does
+  /// not fit in it).
+  void convolve(const std::vector<const Level *> & filters, int level,
+          std::vector<Matrix> & convolutions) const;
+
+  /// Returns the levels of the pyramid projected onto a subspace of the features.
+  /// @param[in] basis Basis of the subspace (see PCA()).
+  /// @param[out] projections Projection of each level (see Project()).
+  /// @param[in] first Index of the first level to project, the projections of the levels before
+  /// it being left empty (e.g. interval() to project only the levels scored by the root filters).
+  void project(const Basis & basis, std::vector<Matrix> & projections, int first = 0) const;
+
+  /// Returns the first principal components of the cells of a set of levels, i.e. the basis of
+  /// the subspace that best preserves the dot products between cells (the second moments are not
+  /// centered).
+  /// @param[in] levels Levels (or filters) whose cells to analyze.
+  /// @param[in] nbDimensions Number of components to return.
+  static Basis PCA(const std::vector<Level> & levels, int nbDimensions);
+
+  /// Returns the projection of a level (or of a filter) onto a subspace of the features.
+  /// @note The size of the projection will be rows x (cols * basis.cols()), each cell being
+  /// replaced by its basis.cols() coordinates in the subspace.
+  static Matrix Project(const Level & level, const Basis & basis);
+
+  /// Returns the 2D convolution of a projected level with a filter projected onto the same
+  /// subspace of @p nbDimensions dimensions (NbFeatures / nbDimensions times cheaper than with
+  /// the full features).
+  /// @note The convolution is empty if the filter does not fit in the level.
+  static void Convolve(const Matrix & x, const Matrix & y, int nbDimensions, Matrix & z);
+
   /// Returns the flipped version (horizontally) of a level.
   static HOGPyramid::Level Flip(const HOGPyramid::Level & level);
 
@@ -121,12 +208,50 @@ private:
   // Efficiently computes Histogram of Oriented Gradient (HOG) features
   // Code to compute HOG features as described in "Object Detection with Discriminatively Trained
   // Part Based Models" by Felzenszwalb, Girshick, McAllester and Ramanan, PAMI 2010
-  static void Hog(const JPEGImage & image, Level & level, int padx = 1, int pady = 1,
+  static void Hog(const ImageView & image, Level & level, int padx = 1, int pady = 1,
           int cellSize = 8);
 
+  // Same as above, but streams the scanlines of a rescaled image instead of reading them from a
+  // stored one. Optionally computes a second level with cells twice as large from the same
+  // gradients (@p coarse) and the image at half the scale (@p half)
+  static void Hog(const ImageResampler & source, Level & level, int padx, int pady, int cellSize,
+          Level * coarse = 0, JPEGImage * half = 0);
+
+  // Accumulates the (unnormalized) histograms of the scanlines [begin, end) of a rescaled image,
+  // as well as the rows of the half scale image they cover
+  static void HogHistograms(const ImageResampler & source, Level & level, int padx, int pady,
+                int cellSize, Level * coarse, JPEGImage * half, int begin, int end);
+
+  // Accumulates the gradients of a scanline into the histograms of a level
+  static void HogAccumulate(const uint8_t * linem, const uint8_t * line, const uint8_t * linep,
+                int width, int depth, int y, const int * bins0, const int * bins1,
+                const Scalar * magnitudes0, const Scalar * magnitudes1, Level & level,
+                int padx, int pady, int cellSize);
+
+  // Computes the normalized features of a level from its histograms
+  static void HogNormalize(Level & level, int padx, int pady);
+
+  // Empties the levels which are not needed or after lastLevel (giving their memory back to the
+  // workspace if there is one), and removes those after lastLevel
+  void trim(const std::vector<bool> & needed, int lastLevel, Workspace * workspace);
+
+  // Returns the index of the level computed in approximate mode nearest to the level z
+  static int NearestComputed(int z, int interval, int maxLevel);
+
+  // Approximates a pyramid level of rows x cols cells (without padding) by resampling another
+  // level in feature space, following "Fast Feature Pyramids for Object Detection" by Dollar,
+  // Appel, Belongie and Perona, PAMI 2014
+  static void Approximate(const Level & level, Level & result, int rows, int cols, double ratio,
+              int padx, int pady);
+
   // Computes the 2D convolution of a pyramid level with a filter
   static void Convolve(const Level & x, const Level & y, Matrix & z);
 
+  // Computes the 2D convolutions of a pyramid level with filters, the filters of the same size
+  // being lowered into a single matrix product when compiled with FFLD_NATIVE_ARCH
+  static void Convolve(const Level & x, const std::vector<const Level *> & y,
+             std::vector<Matrix> & z);
+
   int padx_;
   int pady_;
   int interval_;
@@ -23,12 +23,22 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <utility>
 
 #include <jpeglib.h>
+#include <setjmp.h>
 #include <stdio.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace FFLD;
 using namespace std;
 
@@ -53,7 +63,68 @@ height_(0), depth_(0)
     copy(bits, bits + bits_.size(), bits_.begin());
 }
 
-JPEGImage::JPEGImage(const string & filename) : width_(0), height_(0), depth_(0)
+namespace FFLD
+{
+namespace detail
+{
+// Error manager returning control to Decompress instead of exiting on fatal errors (corrupt data)
+struct JPEGErrorManager : jpeg_error_mgr
+{
+  jmp_buf jump;
+};
+
+static void JPEGErrorExit(j_common_ptr cinfo)
+{
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(static_cast<JPEGErrorManager *>(cinfo->err)->jump, 1);
+}
+
+// Reads the header and decompresses a jpeg image from an initialized source, reducing its size in
+// the DCT domain by the largest power of two (up to 8) such that it does not become smaller than
+// maxSize
+static bool Decompress(jpeg_decompress_struct & cinfo, int maxSize, int & width, int & height,
+             int & depth, vector<uint8_t> & bits)
+{
+  if (setjmp(static_cast<JPEGErrorManager *>(cinfo.err)->jump))
+    return false;
+
+  if ((jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) || (cinfo.data_precision != 8))
+    return false;
+
+  if (maxSize > 0) {
+    const int size = max(cinfo.image_width, cinfo.image_height);
+    int denom = 1;
+
+    while ((denom < 8) && ((size + 2 * denom - 1) / (2 * denom) >= maxSize))
+      denom *= 2;
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+  }
+
+  if (!jpeg_start_decompress(&cinfo))
+    return false;
+
+  width = cinfo.output_width;
+  height = cinfo.output_height;
+  depth = cinfo.output_components;
+  bits.resize(width * height * depth);
+
+  for (int y = 0; y < height; ++y) {
+    JSAMPLE * row = static_cast<JSAMPLE *>(&bits[y * width * depth]);
+
+    if (jpeg_read_scanlines(&cinfo, &row, 1) != 1)
+      return false;
+  }
+
+  jpeg_finish_decompress(&cinfo);
+
+  return true;
+}
+}
+}
+
+JPEGImage::JPEGImage(const string & filename, int maxSize) : width_(0), height_(0), depth_(0)
 {
   // Load the image
   FILE * file = fopen(filename.c_str(), "rb");
@@ -64,40 +135,90 @@ JPEGImage::JPEGImage(const string & filename) : width_(0), height_(0), depth_(0)
   }
 
   jpeg_decompress_struct cinfo;
-  jpeg_error_mgr jerr;
+  detail::JPEGErrorManager jerr;
 
   cinfo.err = jpeg_std_error(&jerr);
+  jerr.error_exit = detail::JPEGErrorExit;
   jpeg_create_decompress(&cinfo);
   jpeg_stdio_src(&cinfo, file);
 
-  if ((jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) || (cinfo.data_precision != 8) ||
-    !jpeg_start_decompress(&cinfo)) {
+  int width, height, depth;
+  vector<uint8_t> bits;
+
+  if (!detail::Decompress(cinfo, maxSize, width, height, depth, bits)) {
+    jpeg_destroy_decompress(&cinfo);
     fclose(file);
-    cerr << filename << " is not an 8-bit jpeg image" << endl;
+    cerr << "Error while loading " << filename << " (not an 8-bit jpeg image?)" << endl;
     return;
   }
 
-  vector<uint8_t> bits(cinfo.image_width * cinfo.image_height * cinfo.num_components);
+  jpeg_destroy_decompress(&cinfo);
 
-  for (int y = 0; y < cinfo.image_height; ++y) {
-    JSAMPLE * row = static_cast<JSAMPLE *>(&bits[y * cinfo.image_width * cinfo.num_components]);
+  fclose(file);
 
-    if (jpeg_read_scanlines(&cinfo, &row, 1) != 1) {
-      fclose(file);
-      cerr << "Error while loading " << filename << endl;
-      return;
-    }
+  // Recopy everyting if the loading was successful
+  width_ = width;
+  height_ = height;
+  depth_ = depth;
+  bits_.swap(bits);
+
+  // Rescale the remaining factor (by steps of at most 2 so that the result is not rounded up)
+  while ((maxSize > 0) && (max(width_, height_) > maxSize))
+    *this = rescale(max((maxSize - 0.001) / max(width_, height_), 0.5));
+}
+
+JPEGImage::JPEGImage(const uint8_t * data, size_t size, int maxSize) : width_(0), height_(0),
+depth_(0)
+{
+  if (!data || !size) {
+    cerr << "Attempting to decode an empty buffer" << endl;
+    return;
   }
 
-  jpeg_finish_decompress(&cinfo);
+  jpeg_decompress_struct cinfo;
+  detail::JPEGErrorManager jerr;
 
-  fclose(file);
+  cinfo.err = jpeg_std_error(&jerr);
+  jerr.error_exit = detail::JPEGErrorExit;
+  jpeg_create_decompress(&cinfo);
 
-  // Recopy everyting if the loading was successful
-  width_ = cinfo.image_width;
-  height_ = cinfo.image_height;
-  depth_ = cinfo.num_components;
+  // Older versions of libjpeg take a non-const buffer even though they do not modify it
+  jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data), size);
+
+  int width, height, depth;
+  vector<uint8_t> bits;
+
+  if (!detail::Decompress(cinfo, maxSize, width, height, depth, bits)) {
+    jpeg_destroy_decompress(&cinfo);
+    cerr << "Error while decoding a jpeg image from memory (not an 8-bit jpeg image?)" << endl;
+    return;
+  }
+
+  jpeg_destroy_decompress(&cinfo);
+
+  width_ = width;
+  height_ = height;
+  depth_ = depth;
   bits_.swap(bits);
+
+  while ((maxSize > 0) && (max(width_, height_) > maxSize))
+    *this = rescale(max((maxSize - 0.001) / max(width_, height_), 0.5));
+}
+
+void JPEGImage::resize(int width, int height, int depth)
+{
+  if ((width <= 0) || (height <= 0) || (depth <= 0)) {
+    width_ = 0;
+    height_ = 0;
+    depth_ = 0;
+    bits_.clear();
+    return;
+  }
+
+  width_ = width;
+  height_ = height;
+  depth_ = depth;
+  bits_.resize(width * height * depth);
 }
 
 bool JPEGImage::empty() const
@@ -178,18 +299,56 @@ void JPEGImage::save(const string & filename, int quality) const
   fclose(file);
 }
 
-// Bilinear interpolation coefficient
+// Separable bilinear resampling
 namespace FFLD
 {
 namespace detail
 {
-struct Bilinear
+// Vertical pass: interpolates two input scanlines (contiguous, vectorizable)
+static void ResampleColumns(const uint8_t * line0, const uint8_t * line1, float weight, int n,
+              float * row)
 {
-  int x0;
-  int x1;
-  double a;
-  double b;
-};
+  for (int e = 0; e < n; ++e) {
+    const float p0 = line0[e];
+    const float p1 = line1[e];
+    row[e] = p0 + (p1 - p0) * weight;
+  }
+}
+
+// Horizontal pass: resamples a vertically interpolated scanline (which must be readable one
+// sample past its end)
+static void ResampleRow(const float * row, const int * offsets0, const int * offsets1,
+            const float * weights, int n, int depth, uint8_t * line)
+{
+  int e = 0;
+
+#ifdef __SSE2__
+  // Interpolate the three channels of a pixel at once, writing one extra byte that is overwritten
+  // by the next pixel (the last pixel is interpolated below)
+  if (depth == 3) {
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (; e < n - 3; e += 3) {
+      const __m128 p0 = _mm_loadu_ps(row + offsets0[e]);
+      const __m128 p1 = _mm_loadu_ps(row + offsets1[e]);
+      const __m128 p = _mm_add_ps(_mm_add_ps(p0, _mm_mul_ps(_mm_sub_ps(p1, p0),
+                                  _mm_set1_ps(weights[e]))), half);
+      __m128i v = _mm_cvttps_epi32(p);
+      v = _mm_packs_epi32(v, v);
+      v = _mm_packus_epi16(v, v);
+
+      const int32_t pixel = _mm_cvtsi128_si32(v);
+      memcpy(line + e, &pixel, 4);
+    }
+  }
+#endif
+
+  for (; e < n; ++e) {
+    const float p0 = row[offsets0[e]];
+    const float p1 = row[offsets1[e]];
+    line[e] = static_cast<int>(p0 + (p1 - p0) * weights[e] + 0.5f);
+  }
+}
 }
 }
 
@@ -201,76 +360,246 @@ JPEGImage* JPEGImage::create_rescale(double scale) const
 
 JPEGImage JPEGImage::rescale(double scale) const
 {
-  // Empty image
-  if (scale <= 0.0)
-    return JPEGImage();
+  JPEGImage result;
+  rescale(scale, result);
+  return result;
+}
 
-  // Same scale
-  if (scale == 1.0)
-    return *this;
+void JPEGImage::rescale(double scale, JPEGImage & result) const
+{
+  ImageView(*this).rescale(scale, result);
+}
 
-  // Scale below 0.5
-  if (scale < 0.5)
-    return rescale(0.5).rescale(2.0 * scale);
+ImageView::ImageView() : bits_(0), width_(0), height_(0), depth_(0), stride_(0)
+{
+}
+
+ImageView::ImageView(const JPEGImage & image) : bits_(image.bits()), width_(image.width()),
+height_(image.height()), depth_(image.depth()), stride_(image.width() * image.depth())
+{
+}
+
+ImageView::ImageView(const uint8_t * bits, int width, int height, int depth, int stride) :
+bits_(0), width_(0), height_(0), depth_(0), stride_(0)
+{
+  if (!bits || (width <= 0) || (height <= 0) || (depth <= 0) ||
+    ((stride > 0) && (stride < width * depth))) {
+    cerr << "Attempting to create an empty image view" << endl;
+    return;
+  }
 
-  const int width = ceil(width_ * scale);
-  const int height = ceil(height_ * scale);
+  bits_ = bits;
+  width_ = width;
+  height_ = height;
+  depth_ = depth;
+  stride_ = (stride > 0) ? stride : (width * depth);
+}
 
+bool ImageView::empty() const
+{
+  return (width() <= 0) || (height() <= 0) || (depth() <= 0);
+}
+
+int ImageView::width() const
+{
+  return width_;
+}
+
+int ImageView::height() const
+{
+  return height_;
+}
+
+int ImageView::depth() const
+{
+  return depth_;
+}
+
+int ImageView::stride() const
+{
+  return stride_;
+}
+
+const uint8_t * ImageView::bits() const
+{
+  return empty() ? 0 : bits_;
+}
+
+const uint8_t * ImageView::scanLine(int y) const
+{
+  return (empty() || (y >= height_)) ? 0 : (bits_ + static_cast<ptrdiff_t>(y) * stride_);
+}
+
+JPEGImage ImageView::rescale(double scale) const
+{
   JPEGImage result;
+  rescale(scale, result);
+  return result;
+}
+
+void ImageView::rescale(double scale, JPEGImage & result) const
+{
+  // Empty image
+  if ((scale <= 0.0) || empty()) {
+    result.resize(0, 0, 0);
+    return;
+  }
+
+  // Same scale
+  if (scale == 1.0) {
+    result.resize(width_, height_, depth_);
+
+    for (int y = 0; y < height_; ++y)
+      copy(scanLine(y), scanLine(y) + width_ * depth_, &result.bits_[y * width_ * depth_]);
 
-  result.width_ = width;
-  result.height_ = height;
-  result.depth_ = depth_;
-  result.bits_.resize(width * height * depth_);
+    return;
+  }
+
+  // Scale below 0.5
+  if (scale < 0.5) {
+    JPEGImage half;
+    rescale(0.5, half);
+    ImageView(half).rescale(2.0 * scale, result);
+    return;
+  }
 
   // Half scale
   if (scale == 0.5) {
+    const int width = ceil(width_ * scale);
+    const int height = ceil(height_ * scale);
+
+    result.resize(width, height, depth_);
+
     for (int i = 0; i < height; ++i) {
-      const int i2 = min(2 * i + 1, height_ - 1);
+      const uint8_t * line0 = scanLine(2 * i);
+      const uint8_t * line1 = scanLine(min(2 * i + 1, height_ - 1));
 
       for (int j = 0; j < width; ++j) {
         const int j2 = min(2 * j + 1, width_ - 1);
 
         for (int k = 0; k < depth_; ++k)
           result.bits_[(i * width + j) * depth_ + k] =
-            (2 + bits_[(2 * i * width_ + 2 * j) * depth_ + k] +
-                  bits_[(2 * i * width_ + j2   ) * depth_ + k] +
-               bits_[(i2    * width_ + 2 * j) * depth_ + k] +
-               bits_[(i2    * width_ + j2   ) * depth_ + k]) >> 2;
+            (2 + line0[2 * j * depth_ + k] + line0[j2 * depth_ + k] +
+                 line1[2 * j * depth_ + k] + line1[j2 * depth_ + k]) >> 2;
       }
     }
 
-    return result;
+    return;
   }
 
-  // Bilinear interpolation coefficients
-  vector<detail::Bilinear> cols(width);
+  // General case, bands of output scanlines are resampled concurrently
+  const ImageResampler resampler(*this, scale);
+  const int width = resampler.width();
+  const int height = resampler.height();
+
+  result.resize(width, height, depth_);
 
-  for (int j = 0; j < width; ++j) {
-    const double x = min(max((j + 0.5) / scale - 0.5, 0.0), width_ - 1.0);
-    cols[j].x0 = x;
-    cols[j].x1 = min(cols[j].x0 + 1, width_ - 1);
-    cols[j].a = x - cols[j].x0;
-    cols[j].b = 1.0 - cols[j].a;
+#ifdef _OPENMP
+  const int nbBands = min(omp_get_max_threads(), height);
+#else
+  const int nbBands = 1;
+#endif
+
+#pragma omp parallel for
+  for (int band = 0; band < nbBands; ++band) {
+    // Vertically interpolated scanline
+    vector<float> row;
+
+    for (int i = band * height / nbBands; i < (band + 1) * height / nbBands; ++i)
+      resampler.scanLine(i, &result.bits_[i * width * depth_], row);
   }
+}
 
-  for (int i = 0; i < height; ++i) {
-    const double y = min(max((i + 0.5) / scale - 0.5, 0.0), height_ - 1.0);
-    const int y0 = y;
-    const int y1 = min(y0 + 1, height_ - 1);
-    const double c = y - y0;
-    const double d = 1.0 - c;
-
-    for (int j = 0; j < width; ++j)
-      for (int k = 0; k < depth_; ++k)
-        result.bits_[(i * width + j) * depth_ + k] =
-          (bits_[(y0 * width_ + cols[j].x0) * depth_ + k] * cols[j].b +
-           bits_[(y0 * width_ + cols[j].x1) * depth_ + k] * cols[j].a) * d +
-          (bits_[(y1 * width_ + cols[j].x0) * depth_ + k] * cols[j].b +
-           bits_[(y1 * width_ + cols[j].x1) * depth_ + k] * cols[j].a) * c + 0.5;
+ImageResampler::ImageResampler() : width_(0), height_(0)
+{
+}
+
+ImageResampler::ImageResampler(const ImageView & image, double scale) : width_(0), height_(0)
+{
+  if (image.empty() || (scale <= 0.5)) {
+    cerr << "Attempting to create an empty image resampler" << endl;
+    return;
   }
 
-  return result;
+  image_ = image;
+  width_ = ceil(image.width() * scale);
+  height_ = ceil(image.height() * scale);
+
+  if (scale == 1.0)
+    return;
+
+  const int width = image.width();
+  const int height = image.height();
+  const int depth = image.depth();
+
+  offsets0_.resize(width_ * depth);
+  offsets1_.resize(width_ * depth);
+  weights_.resize(width_ * depth);
+
+  for (int j = 0; j < width_; ++j) {
+    const double x = min(max((j + 0.5) / scale - 0.5, 0.0), width - 1.0);
+    const int x0 = x;
+    const int x1 = min(x0 + 1, width - 1);
+
+    for (int k = 0; k < depth; ++k) {
+      offsets0_[j * depth + k] = x0 * depth + k;
+      offsets1_[j * depth + k] = x1 * depth + k;
+      weights_[j * depth + k] = x - x0;
+    }
+  }
+
+  rows0_.resize(height_);
+  rows1_.resize(height_);
+  rowWeights_.resize(height_);
+
+  for (int i = 0; i < height_; ++i) {
+    const double y = min(max((i + 0.5) / scale - 0.5, 0.0), height - 1.0);
+    rows0_[i] = y;
+    rows1_[i] = min(rows0_[i] + 1, height - 1);
+    rowWeights_[i] = y - rows0_[i];
+  }
+}
+
+bool ImageResampler::empty() const
+{
+  return (width() <= 0) || (height() <= 0) || (depth() <= 0);
+}
+
+int ImageResampler::width() const
+{
+  return width_;
+}
+
+int ImageResampler::height() const
+{
+  return height_;
+}
+
+int ImageResampler::depth() const
+{
+  return image_.depth();
+}
+
+const uint8_t * ImageResampler::scanLine(int y, uint8_t * line, vector<float> & row) const
+{
+  if (empty() || (y < 0) || (y >= height_))
+    return 0;
+
+  // Same scale
+  if (weights_.empty())
+    return image_.scanLine(y);
+
+  const int n = image_.width() * image_.depth();
+
+  if (row.size() < n + 1)
+    row.resize(n + 1);
+
+  detail::ResampleColumns(image_.scanLine(rows0_[y]), image_.scanLine(rows1_[y]), rowWeights_[y],
+              n, &row[0]);
+  detail::ResampleRow(&row[0], &offsets0_[0], &offsets1_[0], &weights_[0], weights_.size(),
+            image_.depth(), line);
+
+  return line;
 }
 
 ostream & FFLD::operator<<(ostream & os, const JPEGImage & image)
@@ -22,6 +22,7 @@
 #ifndef FFLD_JPEGIMAGE_H
 #define FFLD_JPEGIMAGE_H
 
+#include <cstddef>
 #include <iosfwd>
 #include <string>
 #include <vector>
@@ -50,8 +51,20 @@ public:
 
   /// Constructs an image and tries to load the image from the jpeg file with the given
   /// @p filename.
+  /// @param[in] filename Name of the jpeg file.
+  /// @param[in] maxSize If positive, maximum size (width or height) of the image. Larger images
+  /// are decoded directly at a reduced size by libjpeg (1/2, 1/4 or 1/8 scaling in the DCT
+  /// domain, much faster and using much less memory than decoding them at full size), and then
+  /// rescaled to the exact size.
   /// @note The returned image might be empty if the image could not be loaded.
-  JPEGImage(const std::string & filename);
+  JPEGImage(const std::string & filename, int maxSize = 0);
+
+  /// Constructs an image and tries to decode it from a jpeg file already loaded in memory.
+  /// @param[in] data Content of the jpeg file.
+  /// @param[in] size Size of the content (in bytes).
+  /// @param[in] maxSize If positive, maximum size (width or height) of the image (see above).
+  /// @note The returned image might be empty if the image could not be decoded.
+  JPEGImage(const uint8_t * data, std::size_t size, int maxSize = 0);
 
   /// Returns whether the image is empty. An empty image has zero size.
   bool empty() const;
@@ -79,6 +92,11 @@ public:
   /// index 0. Returns a null pointer if the image is empty or if y is out of bounds.
   uint8_t * scanLine(int y);
 
+  /// Changes the size of the image, reusing its memory when possible. The pixels are left
+  /// uninitialized.
+  /// @note The image will be empty if any of the parameters is incorrect.
+  void resize(int width, int height, int depth);
+
   /// Saves the image to a jpeg file with the given @p filename and @p quality.
   void save(const std::string & filename, int quality = 100) const;
 
@@ -87,11 +105,132 @@ public:
   JPEGImage* create_rescale(double scale) const;
   JPEGImage rescale(double scale) const;
 
+  /// Scales the image to @p scale and stores the result in @p result, reusing its memory. If the
+  /// scale is zero or negative, the result is empty.
+  /// @note @p result must be a different image.
+  void rescale(double scale, JPEGImage & result) const;
+
 private:
   int width_;
   int height_;
   int depth_;
   std::vector<uint8_t> bits_;
+
+  friend class ImageView;
+};
+
+/// The ImageView class references the pixels of an image stored elsewhere (a JPEGImage, or the
+/// frame of an external decoder or library) without copying or owning them. The pixels of each
+/// scanline are stored contiguously as in a JPEGImage, but consecutive scanlines can be separated
+/// by an arbitrary number of bytes (the stride).
+/// @note The referenced pixels must outlive the view.
+class ImageView
+{
+public:
+  /// Constructs an empty view. An empty view has zero size.
+  ImageView();
+
+  /// Constructs a view of the pixels of a JPEGImage.
+  ImageView(const JPEGImage & image);
+
+  /// Constructs a view of the given @p bits.
+  /// @param[in] bits Pointer to the first pixel of the first scanline.
+  /// @param[in] width Width of the image.
+  /// @param[in] height Height of the image.
+  /// @param[in] depth Depth of the image (number of color channels).
+  /// @param[in] stride Number of bytes between the beginnings of two consecutive scanlines. If zero
+  /// or negative, the scanlines are assumed to be contiguous (<tt>width x depth</tt>).
+  /// @note The returned view might be empty if any of the parameters is incorrect.
+  ImageView(const uint8_t * bits, int width, int height, int depth, int stride = 0);
+
+  /// Returns whether the view is empty. An empty view has zero size.
+  bool empty() const;
+
+  /// Returns the width of the image.
+  int width() const;
+
+  /// Returns the height of the image.
+  int height() const;
+
+  /// Returns the depth of the image. The image depth is the number of color channels.
+  int depth() const;
+
+  /// Returns the number of bytes between the beginnings of two consecutive scanlines.
+  int stride() const;
+
+  /// Returns a pointer to the pixel data. Returns a null pointer if the view is empty.
+  const uint8_t * bits() const;
+
+  /// Returns a pointer to the pixel data at the scanline with index y. The first scanline is at
+  /// index 0. Returns a null pointer if the view is empty or if y is out of bounds.
+  const uint8_t * scanLine(int y) const;
+
+  /// Returns a copy of the image scaled to @scale. If the scale is zero or negative, the method
+  /// returns an empty image.
+  JPEGImage rescale(double scale) const;
+
+  /// Scales the image to @p scale and stores the result in @p result, reusing its memory. If the
+  /// scale is zero or negative, the result is empty.
+  /// @note @p result must not be the viewed image.
+  void rescale(double scale, JPEGImage & result) const;
+
+private:
+  const uint8_t * bits_;
+  int width_;
+  int height_;
+  int depth_;
+  int stride_;
+};
+
+/// The ImageResampler class computes the scanlines of a rescaled image one at a time, without
+/// storing the whole rescaled image. The resampling is separable (vertical then horizontal
+/// bilinear interpolation) with precomputed coefficients, and is the one used by
+/// ImageView::rescale for scales above 0.5.
+/// @note The resampled image must outlive the resampler.
+class ImageResampler
+{
+public:
+  /// Constructs an empty resampler. An empty resampler has zero size.
+  ImageResampler();
+
+  /// Constructs a resampler of an @p image to a given @p scale.
+  /// @note The scale must be above 0.5, otherwise the resampler is empty. A scale of 1 returns the
+  /// scanlines of the image itself.
+  ImageResampler(const ImageView & image, double scale);
+
+  /// Returns whether the resampler is empty. An empty resampler has zero size.
+  bool empty() const;
+
+  /// Returns the width of the rescaled image.
+  int width() const;
+
+  /// Returns the height of the rescaled image.
+  int height() const;
+
+  /// Returns the depth of the rescaled image.
+  int depth() const;
+
+  /// Returns the scanline with index y of the rescaled image. The scanline is computed into
+  /// @p line (of <tt>width x depth</tt> bytes) unless the scale is 1, in which case the scanline of
+  /// the image is returned directly. The content of @p row (a temporary buffer) is overwritten.
+  /// @note Can be called concurrently with different buffers.
+  const uint8_t * scanLine(int y, uint8_t * line, std::vector<float> & row) const;
+
+private:
+  ImageView image_;
+  int width_;
+  int height_;
+
+  // Offsets (in bytes from the beginning of a scanline) of the two input samples of each output
+  // sample of a scanline, and weight of the second one
+  std::vector<int> offsets0_;
+  std::vector<int> offsets1_;
+  std::vector<float> weights_;
+
+  // Input scanlines of each output scanline, and weight of the second one
+  std::vector<int> rows0_;
+  std::vector<int> rows1_;
+  std::vector<float> rowWeights_;
 };
 
 /// Serializes an image to a stream.
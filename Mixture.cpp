@@ -35,16 +35,16 @@ using namespace Eigen;
 using namespace FFLD;
 using namespace std;
 
-Mixture::Mixture() : cached_(false), zero_(true)
+Mixture::Mixture() : zero_(true)
 {
 }
 
-Mixture::Mixture(const vector<Model> & models) : models_(models), cached_(false), zero_(true)
+Mixture::Mixture(const vector<Model> & models) : models_(models), zero_(true)
 {
 }
 
 Mixture::Mixture(int nbComponents, const vector<Scene> & scenes, Object::Name name) :
-cached_(false), zero_(true)
+zero_(true)
 {
   // Create an empty mixture if any of the given parameters is invalid
   if ((nbComponents <= 0) || scenes.empty()) {
@@ -83,6 +83,26 @@ vector<Model> & Mixture::models()
   return models_;
 }
 
+const vector<vector<double> > & Mixture::thresholds() const
+{
+  return thresholds_;
+}
+
+vector<vector<double> > & Mixture::thresholds()
+{
+  return thresholds_;
+}
+
+const HOGPyramid::Basis & Mixture::basis() const
+{
+  return basis_;
+}
+
+HOGPyramid::Basis & Mixture::basis()
+{
+  return basis_;
+}
+
 pair<int, int> Mixture::minSize() const
 {
   pair<int, int> size(0, 0);
@@ -115,6 +135,24 @@ pair<int, int> Mixture::maxSize() const
   return size;
 }
 
+pair<double, double> Mixture::scaleRange(int minHeight, int maxHeight) const
+{
+  // An object of height h detected by a root filter of r rows (of 8 pixels at scale 1) is at
+  // scale 8 r / h
+  pair<double, double> range(0.0, 2.0);
+
+  if (empty())
+    return range;
+
+  if (maxHeight > 0)
+    range.first = 8.0 * minSize().first / maxHeight;
+
+  if (minHeight > 0)
+    range.second = 8.0 * maxSize().first / minHeight;
+
+  return range;
+}
+
 double Mixture::train(const vector<Scene> & scenes, Object::Name name, int padx, int pady,
             int interval, int nbRelabel, int nbDatamine, int maxNegatives, double C,
             double J, double overlap)
@@ -234,7 +272,8 @@ double Mixture::train(const vector<Scene> & scenes, Object::Name name, int padx,
 
       // The filters definitely changed
       filterCache_.clear();
-      cached_ = false;
+      thresholds_.clear();
+      basis_ = HOGPyramid::Basis();
       zero_ = false;
 
       // Save the latest model so as to be able to look at it while training
@@ -262,14 +301,148 @@ void Mixture::initializeParts(int nbParts, pair<int, int> partSize)
 
   // The filters definitely changed
   filterCache_.clear();
-  cached_ = false;
+  thresholds_.clear();
+  basis_ = HOGPyramid::Basis();
   zero_ = false;
 }
 
+void Mixture::trainCascade(const vector<Scene> & scenes, Object::Name name, int padx, int pady,
+               int interval, double overlap, double threshold, int nbDimensions)
+{
+  thresholds_.clear();
+  basis_ = HOGPyramid::Basis();
+
+  // Test if the models are really zero by looking at the first cell of the first filter of the
+  // first model
+  if (!empty() && models_[0].parts()[0].filter.size() &&
+    !models_[0].parts()[0].filter(0, 0).isZero())
+    zero_ = false;
+
+  if (empty() || zero_) {
+    cerr << "Attempting to learn the cascade thresholds of an untrained mixture" << endl;
+    return;
+  }
+
+  // Sample all the positives
+  vector<pair<Model, int> > positives;
+
+  posLatentSearch(scenes, name, padx, pady, interval, overlap, positives);
+
+  const int nbModels = static_cast<int>(models_.size());
+
+  // Learn the subspace of the projected features from the features of the positives
+  HOGPyramid::Basis basis;
+
+  if (nbDimensions > 0) {
+    vector<HOGPyramid::Level> features;
+
+    for (int i = 0; i < positives.size(); ++i)
+      for (int j = 0; j < positives[i].first.parts().size(); ++j)
+        features.push_back(positives[i].first.parts()[j].filter);
+
+    if (!features.empty())
+      basis = HOGPyramid::PCA(features, nbDimensions);
+  }
+
+  vector<HOGPyramid::Matrix> roots(nbModels);
+
+  if (basis.cols())
+    for (int i = 0; i < nbModels; ++i)
+      roots[i] = HOGPyramid::Project(models_[i].parts()[0].filter, basis);
+
+  vector<vector<double> > thresholds(nbModels);
+
+  for (int i = 0; i < nbModels; ++i)
+    thresholds[i].resize(2 * models_[i].parts().size(), numeric_limits<double>::infinity());
+
+  // Minimum of each partial score over the positives scoring above the threshold
+  for (int i = 0; i < positives.size(); ++i) {
+    const Model & model = models_[positives[i].second];
+    const Model & sample = positives[i].first;
+
+    if (model.dot(sample) < threshold)
+      continue;
+
+    vector<double> & t = thresholds[positives[i].second];
+
+    double score = model.bias();
+
+    for (int y = 0; y < model.parts()[0].filter.rows(); ++y)
+      score += HOGPyramid::Map(model.parts()[0].filter).row(y).dot(
+           HOGPyramid::Map(sample.parts()[0].filter).row(y));
+
+    // Score of the root with the projected features (unused without a basis)
+    if (basis.cols())
+      t[0] = min(t[0], model.bias() + roots[positives[i].second].cwiseProduct(
+                 HOGPyramid::Project(sample.parts()[0].filter, basis)).sum());
+    else
+      t[0] = min(t[0], score);
+
+    t[1] = min(t[1], score);
+
+    for (int j = 1; j < model.parts().size(); ++j) {
+      const double cost = model.parts()[j].deformation.dot(sample.parts()[j].deformation);
+
+      t[2 * j] = min(t[2 * j], score + cost);
+
+      score += cost;
+
+      for (int y = 0; y < model.parts()[j].filter.rows(); ++y)
+        score += HOGPyramid::Map(model.parts()[j].filter).row(y).dot(
+             HOGPyramid::Map(sample.parts()[j].filter).row(y));
+
+      t[2 * j + 1] = min(t[2 * j + 1], score);
+    }
+  }
+
+  // The models and their flipped versions share their thresholds
+  for (int i = 0; i + 1 < nbModels; i += 2) {
+    for (int j = 0; j < thresholds[i].size(); ++j) {
+      thresholds[i][j] = min(thresholds[i][j], thresholds[i + 1][j]);
+      thresholds[i + 1][j] = thresholds[i][j];
+    }
+  }
+
+  // The models without such positive will be evaluated fully
+  for (int i = 0; i < nbModels; ++i) {
+    if (thresholds[i][0] == numeric_limits<double>::infinity()) {
+      cerr << "No positive scoring above " << threshold << " for model " << i
+         << ", could not learn its cascade thresholds" << endl;
+      thresholds[i].clear();
+    }
+
+    // Leave some room for the rounding errors of the convolutions (in single precision) so as
+    // not to prune the positives themselves
+    for (int j = 0; j < thresholds[i].size(); ++j)
+      thresholds[i][j] -= 0.001;
+  }
+
+  thresholds_.swap(thresholds);
+  basis_.swap(basis);
+}
+
+// Returns the fraction of the distance transforms of the models skipped
+static double skippedFraction(const vector<Model> & models,
+                const vector<vector<HOGPyramid::Matrix> > & scores, int nbSkipped)
+{
+  int nbTransforms = 0;
+
+  for (int i = 0; i < models.size(); ++i)
+    for (int z = 0; z < scores[i].size(); ++z)
+      if (scores[i][z].size())
+        nbTransforms += static_cast<int>(models[i].parts().size()) - 1;
+
+  return nbTransforms ? static_cast<double>(nbSkipped) / nbTransforms : 0.0;
+}
+
 void Mixture::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & scores,
              vector<Indices> & argmaxes,
-             vector<vector<vector<Model::Positions> > > * positions) const
+             vector<vector<vector<Model::Positions> > > * positions,
+             Patchwork::Workspace * workspace, double threshold, double * skipped) const
 {
+  if (skipped)
+    *skipped = 0.0;
+
   if (empty() || pyramid.empty()) {
     scores.clear();
     argmaxes.clear();
@@ -280,13 +453,11 @@ void Mixture::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> &
     return;
   }
 
-  const int nbModels = static_cast<int>(models_.size());
-  const int nbLevels = static_cast<int>(pyramid.levels().size());
-
   // Convolve with all the models
   vector<vector<HOGPyramid::Matrix> > convolutions;
+  int nbSkipped = 0;
 
-  convolve(pyramid, convolutions, positions);
+  convolve(pyramid, convolutions, positions, workspace, threshold, &nbSkipped);
 
   // In case of error
   if (convolutions.empty()) {
@@ -299,6 +470,232 @@ void Mixture::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> &
     return;
   }
 
+  if (skipped)
+    *skipped = skippedFraction(models_, convolutions, nbSkipped);
+
+  Combine(convolutions, scores, argmaxes);
+}
+
+void Mixture::cascade(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & scores,
+             vector<Indices> & argmaxes,
+             vector<vector<vector<Model::Positions> > > * positions,
+             Patchwork::Workspace * workspace) const
+{
+  // Evaluate each model
+  vector<vector<HOGPyramid::Matrix> > tmp;
+
+  cascade(pyramid, tmp, positions, workspace);
+
+  // In case of error
+  if (tmp.empty()) {
+    scores.clear();
+    argmaxes.clear();
+
+    if (positions)
+      positions->clear();
+
+    return;
+  }
+
+  Combine(tmp, scores, argmaxes);
+}
+
+void Mixture::cascade(const HOGPyramid & pyramid, vector<vector<HOGPyramid::Matrix> > & scores,
+             vector<vector<vector<Model::Positions> > > * positions,
+             Patchwork::Workspace * workspace) const
+{
+  // Fall back to the full convolutions if the thresholds were not learned (or for 3D models)
+#ifndef FFLD_MODEL_3D
+  if (thresholds_.size() != models_.size())
+#endif
+  {
+    convolve(pyramid, scores, positions, workspace);
+    return;
+  }
+
+  if (pyramid.empty()) {
+    scores.clear();
+
+    if (positions)
+      positions->clear();
+
+    return;
+  }
+
+  const int nbModels = static_cast<int>(models_.size());
+
+  // Project the root levels of the pyramid once for all the models
+  vector<HOGPyramid::Matrix> projections;
+
+  if (basis_.cols())
+    pyramid.project(basis_, projections, pyramid.interval());
+
+  // Evaluate the parts of each model where its cascade does not prune them, or everywhere if it
+  // has no cascade
+  scores.resize(nbModels);
+
+  if (positions)
+    positions->resize(nbModels);
+
+  for (int i = 0; i < nbModels; ++i) {
+    if (!thresholds_[i].empty())
+      models_[i].cascade(pyramid, thresholds_[i], scores[i], positions ? &(*positions)[i] : 0,
+                 basis_.cols() ? &basis_ : 0, &projections);
+    else
+      models_[i].convolve(pyramid, scores[i], positions ? &(*positions)[i] : 0);
+
+    // In case of error
+    if (scores[i].empty()) {
+      scores.clear();
+
+      if (positions)
+        positions->clear();
+
+      return;
+    }
+  }
+}
+
+// Orders the detections by increasing score (the best one is at the top of a heap)
+static inline bool lowerScore(const Mixture::Detection & a, const Mixture::Detection & b)
+{
+  return a.score < b.score;
+}
+
+void Mixture::detect(const HOGPyramid & pyramid, int width, int height, double threshold,
+           double overlap, int maxDetections, vector<Detection> & detections,
+           bool cascade, Patchwork::Workspace * workspace, double * skipped) const
+{
+  detections.clear();
+
+  if (skipped)
+    *skipped = 0.0;
+
+  if (empty() || pyramid.empty())
+    return;
+
+  // Scores of each model
+  vector<vector<HOGPyramid::Matrix> > convolutions;
+
+  if (cascade) {
+    this->cascade(pyramid, convolutions, 0, workspace);
+  }
+  else {
+    int nbSkipped = 0;
+
+    convolve(pyramid, convolutions, 0, workspace, threshold, &nbSkipped);
+
+    if (skipped && !convolutions.empty())
+      *skipped = skippedFraction(models_, convolutions, nbSkipped);
+  }
+
+  // In case of error
+  if (convolutions.empty())
+    return;
+
+  extract(pyramid, convolutions, width, height, threshold, overlap, maxDetections, detections);
+}
+
+void Mixture::extract(const HOGPyramid & pyramid,
+            vector<vector<HOGPyramid::Matrix> > & convolutions, int width, int height,
+            double threshold, double overlap, int maxDetections,
+            vector<Detection> & detections) const
+{
+  detections.clear();
+
+  const int nbModels = static_cast<int>(models_.size());
+  const int nbLevels = static_cast<int>(convolutions[0].size());
+
+  // Cache the size of the models
+  vector<pair<int, int> > sizes(nbModels);
+
+  for (int i = 0; i < nbModels; ++i)
+    sizes[i] = models_[i].rootSize();
+
+  // Local maxima of the scores above the threshold at each level
+  vector<vector<Detection> > candidates(nbLevels);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int z = 0; z < nbLevels; ++z) {
+    // Combine the models at this level only, releasing their scores
+    vector<vector<HOGPyramid::Matrix> > level(nbModels, vector<HOGPyramid::Matrix>(1));
+    vector<HOGPyramid::Matrix> scores;
+    vector<Indices> argmaxes;
+
+    for (int i = 0; i < nbModels; ++i)
+      level[i][0].swap(convolutions[i][z]);
+
+    Combine(level, scores, argmaxes);
+
+    const HOGPyramid::Matrix & s = scores[0];
+    const double scale = pow(2.0, static_cast<double>(z) / pyramid.interval() + 2);
+    const int rows = static_cast<int>(s.rows());
+    const int cols = static_cast<int>(s.cols());
+
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < cols; ++x) {
+        const double score = s(y, x);
+
+        // Non-maxima suppresion in a 3x3 neighborhood
+        if ((score > threshold) &&
+          ((y == 0) || (x == 0) || (score >= s(y - 1, x - 1))) &&
+          ((y == 0) || (score >= s(y - 1, x))) &&
+          ((y == 0) || (x == cols - 1) || (score >= s(y - 1, x + 1))) &&
+          ((x == 0) || (score >= s(y, x - 1))) &&
+          ((x == cols - 1) || (score >= s(y, x + 1))) &&
+          ((y == rows - 1) || (x == 0) || (score >= s(y + 1, x - 1))) &&
+          ((y == rows - 1) || (score >= s(y + 1, x))) &&
+          ((y == rows - 1) || (x == cols - 1) || (score >= s(y + 1, x + 1)))) {
+          const int model = argmaxes[0](y, x);
+
+          Rectangle bndbox((x - pyramid.padx()) * scale + 0.5,
+                   (y - pyramid.pady()) * scale + 0.5,
+                   sizes[model].second * scale + 0.5, sizes[model].first * scale + 0.5);
+
+          // Truncate the object
+          bndbox.setX(max(bndbox.x(), 0));
+          bndbox.setY(max(bndbox.y(), 0));
+          bndbox.setWidth(min(bndbox.width(), width - bndbox.x()));
+          bndbox.setHeight(min(bndbox.height(), height - bndbox.y()));
+
+          if (!bndbox.empty())
+            candidates[z].push_back(Detection(s(y, x), model, Model::Position(x, y, z),
+                              bndbox));
+        }
+      }
+    }
+  }
+
+  // Non maxima suppression, popping the candidates by decreasing score only until enough
+  // detections are kept
+  vector<Detection> heap;
+
+  for (int z = 0; z < nbLevels; ++z)
+    heap.insert(heap.end(), candidates[z].begin(), candidates[z].end());
+
+  make_heap(heap.begin(), heap.end(), lowerScore);
+
+  while (!heap.empty() && ((maxDetections <= 0) || (detections.size() < maxDetections))) {
+    pop_heap(heap.begin(), heap.end(), lowerScore);
+
+    bool suppressed = false;
+
+    for (int i = 0; (i < detections.size()) && !suppressed; ++i)
+      suppressed = Intersector(detections[i], overlap, true)(heap.back());
+
+    if (!suppressed)
+      detections.push_back(heap.back());
+
+    heap.pop_back();
+  }
+}
+
+void Mixture::Combine(const vector<vector<HOGPyramid::Matrix> > & convolutions,
+            vector<HOGPyramid::Matrix> & scores, vector<Indices> & argmaxes)
+{
+  const int nbModels = static_cast<int>(convolutions.size());
+  const int nbLevels = static_cast<int>(convolutions[0].size());
+
   // Resize the scores and argmaxes
   scores.resize(nbLevels);
   argmaxes.resize(nbLevels);
@@ -331,26 +728,20 @@ void Mixture::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> &
   }
 }
 
-void Mixture::cacheFilters() const
+void Mixture::cacheFilters(int rows, int cols) const
 {
-  // Count the number of filters
-  int nbFilters = 0;
-
-  for (int i = 0; i < models_.size(); ++i)
-    nbFilters += models_[i].parts().size();
-
-  // Transform all the filters
-  filterCache_.resize(nbFilters);
+  filterCache_.filters(filters(), rows, cols);
+}
 
-  for (int i = 0, j = 0; i < models_.size(); ++i) {
-#pragma omp parallel for
-    for (int k = 0; k < models_[i].parts().size(); ++k)
-      Patchwork::TransformFilter(models_[i].parts()[k].filter, filterCache_[j + k]);
+vector<const HOGPyramid::Level *> Mixture::filters() const
+{
+  vector<const HOGPyramid::Level *> filters;
 
-    j += models_[i].parts().size();
-  }
+  for (int i = 0; i < models_.size(); ++i)
+    for (int j = 0; j < models_[i].parts().size(); ++j)
+      filters.push_back(&models_[i].parts()[j].filter);
 
-  cached_ = true;
+  return filters;
 }
 
 static inline void clipBndBox(Rectangle & bndbox, const Scene & scene, double alpha = 0.0)
@@ -874,8 +1265,12 @@ double Mixture::train(const vector<pair<Model, int> > & positives,
 
 void Mixture::convolve(const HOGPyramid & pyramid,
              vector<vector<HOGPyramid::Matrix> > & scores,
-             vector<vector<vector<Model::Positions> > > * positions) const
+             vector<vector<vector<Model::Positions> > > * positions,
+             Patchwork::Workspace * workspace, double threshold, int * skipped) const
 {
+  if (skipped)
+    *skipped = 0;
+
   if (empty() || pyramid.empty()) {
     scores.clear();
 
@@ -893,21 +1288,38 @@ void Mixture::convolve(const HOGPyramid & pyramid,
   if (positions)
     positions->resize(nbModels);
 
-  // Transform the filters if needed
 #ifndef FFLD_MIXTURE_STANDARD_CONVOLUTION
-#pragma omp critical
-  if (!cached_)
-    cacheFilters();
+  // Convolve the pyramid with all the filters of the models
+  vector<vector<HOGPyramid::Matrix> > convolutions;
+
+  Patchwork::Convolve(pyramid, filters(), filterCache_, convolutions, workspace);
+
+  convolve(pyramid, convolutions, scores, positions, threshold, skipped);
+#else
+  // For each model (Model::convolve already distributes the convolutions and the distance
+  // transforms of its parts over all the threads)
+  for (int i = 0; i < nbModels; ++i) {
+    int nbSkipped = 0;
 
-  while (!cached_);
+    models_[i].convolve(pyramid, scores[i], positions ? &(*positions)[i] : 0, 0, threshold,
+              &nbSkipped);
 
-  // Create a patchwork
-  const Patchwork patchwork(pyramid);
+    if (skipped)
+      *skipped += nbSkipped;
+  }
+#endif
+}
 
-  // Convolve the patchwork with the filters
-  vector<vector<HOGPyramid::Matrix> > convolutions(filterCache_.size());
+void Mixture::convolve(const HOGPyramid & pyramid,
+             vector<vector<HOGPyramid::Matrix> > & convolutions,
+             vector<vector<HOGPyramid::Matrix> > & scores,
+             vector<vector<vector<Model::Positions> > > * positions, double threshold,
+             int * skipped) const
+{
+  if (skipped)
+    *skipped = 0;
 
-  patchwork.convolve(filterCache_, convolutions);
+  const int nbModels = static_cast<int>(models_.size());
 
   // In case of error
   if (convolutions.empty()) {
@@ -919,6 +1331,12 @@ void Mixture::convolve(const HOGPyramid & pyramid,
     return;
   }
 
+  // Resize the scores and positions
+  scores.resize(nbModels);
+
+  if (positions)
+    positions->resize(nbModels);
+
   // Save the offsets of each model in the filter list
   vector<int> offsets(nbModels);
 
@@ -927,15 +1345,21 @@ void Mixture::convolve(const HOGPyramid & pyramid,
     j += models_[i].parts().size();
   }
 
-  // For each model
-#pragma omp parallel for
+  // For each model (Model::convolve already distributes the distance transforms of its parts
+  // over all the threads)
   for (int i = 0; i < nbModels; ++i) {
     vector<vector<HOGPyramid::Matrix> > tmp(models_[i].parts().size());
 
     for (int j = 0; j < tmp.size(); ++j)
       tmp[j].swap(convolutions[offsets[i] + j]);
 
-    models_[i].convolve(pyramid, scores[i], positions ? &(*positions)[i] : 0, &tmp);
+    int nbSkipped = 0;
+
+    models_[i].convolve(pyramid, scores[i], positions ? &(*positions)[i] : 0, &tmp, threshold,
+              &nbSkipped);
+
+    if (skipped)
+      *skipped += nbSkipped;
   }
 
   // In case of error
@@ -945,13 +1369,10 @@ void Mixture::convolve(const HOGPyramid & pyramid,
 
       if (positions)
         positions->clear();
+
+      return;
     }
   }
-#else
-#pragma omp parallel for
-  for (int i = 0; i < nbModels; ++i)
-    models_[i].convolve(pyramid, scores[i], positions ? &(*positions)[i] : 0);
-#endif
 }
 
 vector<pair<int, int> > Mixture::FilterSizes(int nbComponents, const vector<Scene> & scenes,
@@ -1096,6 +1517,27 @@ ostream & FFLD::operator<<(ostream & os, const Mixture & mixture)
   for (int i = 0; i < mixture.models().size(); ++i)
     os << mixture.models()[i] << endl;
 
+  // Save the thresholds of the star-cascades if they were learned
+  for (int i = 0; i < mixture.thresholds().size(); ++i) {
+    os << mixture.thresholds()[i].size();
+
+    for (int j = 0; j < mixture.thresholds()[i].size(); ++j)
+      os << ' ' << mixture.thresholds()[i][j];
+
+    os << endl;
+  }
+
+  // Save the basis of the projected features used by the star-cascades
+  if (!mixture.thresholds().empty()) {
+    os << mixture.basis().cols();
+
+    for (int i = 0; i < mixture.basis().rows(); ++i)
+      for (int j = 0; j < mixture.basis().cols(); ++j)
+        os << ' ' << mixture.basis()(i, j);
+
+    os << endl;
+  }
+
   return os;
 }
 
@@ -1121,7 +1563,56 @@ istream & FFLD::operator>>(istream & is, Mixture & mixture)
     }
   }
 
+  // Load the thresholds of the star-cascades and their basis if they follow
+  vector<vector<double> > thresholds;
+  HOGPyramid::Basis basis;
+
+  if (!is.eof())
+    is >> ws;
+
+  if (!is.eof()) {
+    thresholds.resize(nbModels);
+
+    for (int i = 0; i < nbModels; ++i) {
+      int nbThresholds;
+
+      is >> nbThresholds;
+
+      if (!is || (nbThresholds && (nbThresholds != 2 * models[i].parts().size()))) {
+        mixture = Mixture();
+        return is;
+      }
+
+      thresholds[i].resize(nbThresholds);
+
+      for (int j = 0; j < nbThresholds; ++j)
+        is >> thresholds[i][j];
+    }
+
+    int nbDimensions;
+
+    is >> nbDimensions;
+
+    if (!is || (nbDimensions < 0) || (nbDimensions > HOGPyramid::NbFeatures)) {
+      mixture = Mixture();
+      return is;
+    }
+
+    basis.resize(HOGPyramid::NbFeatures, nbDimensions);
+
+    for (int i = 0; i < basis.rows(); ++i)
+      for (int j = 0; j < basis.cols(); ++j)
+        is >> basis(i, j);
+
+    if (!is) {
+      mixture = Mixture();
+      return is;
+    }
+  }
+
   mixture.models().swap(models);
+  mixture.thresholds().swap(thresholds);
+  mixture.basis().swap(basis);
 
   return is;
 }
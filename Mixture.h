@@ -35,6 +35,32 @@ public:
   /// Type of a matrix of indices.
   typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Indices;
 
+  /// The Detection structure stores a detection: its bounding box in image coordinates, its score,
+  /// and the model and position of its root in the pyramid.
+  struct Detection : public Rectangle
+  {
+    HOGPyramid::Scalar score; ///< Score of the detection.
+    int model;        ///< Index of the model (mixture component).
+    Model::Position root;   ///< Position of the root in the pyramid (x y z).
+
+    /// Constructs an empty detection.
+    Detection() : score(0), model(0), root(Model::Position::Zero())
+    {
+    }
+
+    /// Constructs a detection from parameters.
+    Detection(HOGPyramid::Scalar score, int model, const Model::Position & root,
+          const Rectangle & bndbox) : Rectangle(bndbox), score(score), model(model), root(root)
+    {
+    }
+
+    /// Orders the detections by decreasing score.
+    bool operator<(const Detection & detection) const
+    {
+      return score > detection.score;
+    }
+  };
+
   /// Constructs an empty mixture. An empty mixture has no model.
   Mixture();
 
@@ -64,6 +90,11 @@ public:
   /// Returns the maximum root filter size (<tt>rows x cols</tt>).
   std::pair<int, int> maxSize() const;
 
+  /// Returns the range of pyramid scales (see HOGPyramid) at which the root filters detect objects
+  /// between @p minHeight and @p maxHeight pixels tall, to be passed to the HOGPyramid
+  /// constructor. A height of zero means no limit.
+  std::pair<double, double> scaleRange(int minHeight, int maxHeight) const;
+
   /// Trains the mixture.
   /// @param[in] scenes Scenes to use for training.
   /// @param[in] name Name of the objects to detect.
@@ -82,6 +113,42 @@ public:
          int interval = 5, int nbRelabel = 5, int nbDatamine = 10, int maxNegatives = 24000,
          double C = 0.002, double J = 2.0, double overlap = 0.7);
 
+  /// Learns the pruning thresholds of the star-cascade (see cascade()) from the training positives
+  /// (Felzenszwalb's probably approximately admissible thresholds): each threshold is the minimum
+  /// of the corresponding partial scores over the positives scoring above @p threshold. Also
+  /// learns the basis of the projected features on which the roots are first scored from the
+  /// features of the positives (see HOGPyramid::PCA).
+  /// @param[in] scenes Scenes to use for training.
+  /// @param[in] name Name of the objects to detect.
+  /// @param[in] padx Amount of horizontal zero padding (in cells).
+  /// @param[in] pady Amount of vertical zero padding (in cells).
+  /// @param[in] interval Number of levels per octave in the pyramid.
+  /// @param[in] overlap Minimum overlap in latent positive search.
+  /// @param[in] threshold Minimum score of the positives to consider.
+  /// @param[in] nbDimensions Dimension of the projected features (0 to score the roots with the
+  /// full features only).
+  /// @note The thresholds of a model are left empty if it has no such positive, and all the
+  /// thresholds are cleared whenever the models are retrained.
+  void trainCascade(const std::vector<Scene> & scenes, Object::Name name, int padx = 12,
+            int pady = 12, int interval = 5, double overlap = 0.7, double threshold = -1.0,
+            int nbDimensions = 5);
+
+  /// Returns the pruning thresholds of the star-cascade of each model (see Model::cascade), empty
+  /// if they were not learned.
+  const std::vector<std::vector<double> > & thresholds() const;
+
+  /// Returns the pruning thresholds of the star-cascade of each model (see Model::cascade), empty
+  /// if they were not learned.
+  std::vector<std::vector<double> > & thresholds();
+
+  /// Returns the basis of the projected features used by the star-cascades (see
+  /// HOGPyramid::PCA), empty if the roots are scored with the full features only.
+  const HOGPyramid::Basis & basis() const;
+
+  /// Returns the basis of the projected features used by the star-cascades (see
+  /// HOGPyramid::PCA), empty if the roots are scored with the full features only.
+  HOGPyramid::Basis & basis();
+
   /// Initializes the specidied number of parts from the root of each model.
   /// @param[in] nbParts Number of parts (without the root).
   /// @param[in] partSize Size of each part (<tt>rows x cols</tt>).
@@ -95,12 +162,59 @@ public:
   /// level.
   /// @param[out] positions Positions of each part of each model for each pyramid level
   /// (<tt>models x parts x levels</tt>).
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// convolutions (see Patchwork::Workspace, one per thread).
+  /// @param[in] threshold Detection threshold. The parts are not transformed at the levels whose
+  /// scores cannot pass it, where the scores are set to minus infinity (see Model::convolve).
+  /// @param[out] skipped Fraction of the distance transforms skipped thanks to @p threshold.
   void convolve(const HOGPyramid & pyramid, std::vector<HOGPyramid::Matrix> & scores,
           std::vector<Indices> & argmaxes,
-          std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0) const;
+          std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0,
+          Patchwork::Workspace * workspace = 0,
+          double threshold = -std::numeric_limits<double>::infinity(),
+          double * skipped = 0) const;
 
-  /// Caches the transformed version of the models' filters.
-  void cacheFilters() const;
+  /// Returns the scores of the models with a pyramid of features using their star-cascades (see
+  /// Model::cascade). The root filters are convolved with every root level (with the projected features
+  /// first if a basis was learned), but the parts are only evaluated where the partial scores
+  /// pass the thresholds learned by trainCascade().
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[out] scores Scores for each pyramid level (minus infinity at the pruned locations).
+  /// @param[out] argmaxes Indices of the best model (mixture component) for each pyramid
+  /// level.
+  /// @param[out] positions Positions of each part of each model for each pyramid level
+  /// (<tt>models x parts x levels</tt>).
+  /// @param[in] workspace Optional workspace passed to convolve().
+  /// @note The models without thresholds are evaluated fully (see Model::convolve), and all of
+  /// them if the thresholds were not learned.
+  void cascade(const HOGPyramid & pyramid, std::vector<HOGPyramid::Matrix> & scores,
+         std::vector<Indices> & argmaxes,
+         std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0,
+         Patchwork::Workspace * workspace = 0) const;
+
+  /// Detects objects in a pyramid of features. The scores of the models are combined, their local
+  /// maxima above @p threshold extracted and mapped to the image, one pyramid level at a time (in
+  /// parallel), and non-maxima suppression (Felzenszwalb's criterion) applied in order of
+  /// decreasing score until @p maxDetections are kept.
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[in] width, height Size of the image (the bounding boxes are truncated to it).
+  /// @param[in] threshold Minimum score of the detections.
+  /// @param[in] overlap Maximum overlap of the detections (see Intersector).
+  /// @param[in] maxDetections Maximum number of detections to return (0 for no limit).
+  /// @param[out] detections Detections, by decreasing score.
+  /// @param[in] cascade Whether to use the star-cascades of the models (see cascade()).
+  /// @param[in] workspace Optional workspace passed to convolve().
+  /// @param[out] skipped Fraction of the distance transforms skipped thanks to @p threshold (see
+  /// convolve()), always zero with @p cascade as the pruning of the cascades is not counted.
+  void detect(const HOGPyramid & pyramid, int width, int height, double threshold,
+        double overlap, int maxDetections, std::vector<Detection> & detections,
+        bool cascade = false, Patchwork::Workspace * workspace = 0,
+        double * skipped = 0) const;
+
+  /// Caches the transformed version of the models' filters for patchwork planes of
+  /// @p rows x @p cols (see Patchwork::rows() and Patchwork::cols()).
+  /// @note The filters are otherwise transformed the first time a patchwork of a new size is used.
+  void cacheFilters(int rows, int cols) const;
 
 private:
   // Extracts all the positives
@@ -119,10 +233,42 @@ private:
          int maxIterations = 400);
 
   // Returns the scores of the convolutions + distance transforms of the models with a pyramid of
-  // features (useful to compute the SVM margins)
+  // features (useful to compute the SVM margins), and the number of distance transforms skipped
+  // thanks to the threshold
   void convolve(const HOGPyramid & pyramid,
           std::vector<std::vector<HOGPyramid::Matrix> > & scores,
-          std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0) const;
+          std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0,
+          Patchwork::Workspace * workspace = 0,
+          double threshold = -std::numeric_limits<double>::infinity(),
+          int * skipped = 0) const;
+
+  // Returns the scores of the models given the convolutions of the pyramid with all their filters
+  // (in the order of the models and of their parts, the convolutions are consumed), and the number
+  // of distance transforms skipped thanks to the threshold
+  void convolve(const HOGPyramid & pyramid,
+          std::vector<std::vector<HOGPyramid::Matrix> > & convolutions,
+          std::vector<std::vector<HOGPyramid::Matrix> > & scores,
+          std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0,
+          double threshold = -std::numeric_limits<double>::infinity(),
+          int * skipped = 0) const;
+
+  // Returns the scores of the models using their star-cascades, or of the convolutions + distance
+  // transforms of those without
+  void cascade(const HOGPyramid & pyramid,
+         std::vector<std::vector<HOGPyramid::Matrix> > & scores,
+         std::vector<std::vector<std::vector<Model::Positions> > > * positions = 0,
+         Patchwork::Workspace * workspace = 0) const;
+
+  // Extracts the detections from the scores of the models (consumed), see detect()
+  void extract(const HOGPyramid & pyramid,
+         std::vector<std::vector<HOGPyramid::Matrix> > & convolutions, int width, int height,
+         double threshold, double overlap, int maxDetections,
+         std::vector<Detection> & detections) const;
+
+  // Returns the maximum of the scores of the models at each pyramid level, and the index of the
+  // best model
+  static void Combine(const std::vector<std::vector<HOGPyramid::Matrix> > & convolutions,
+            std::vector<HOGPyramid::Matrix> & scores, std::vector<Indices> & argmaxes);
 
   // Computes the size of the roots of the models
   static std::vector<std::pair<int, int> > FilterSizes(int nbComponents,
@@ -132,14 +278,21 @@ private:
   // Attempts to split samples into a left facing cluster and a right facing cluster
   static void Cluster(int nbComponents, std::vector<std::pair<Model, int> > & samples);
 
+  // Returns the filters of all the models (in the order of the models and of their parts)
+  std::vector<const HOGPyramid::Level *> filters() const;
+
   std::vector<Model> models_;
+  std::vector<std::vector<double> > thresholds_; // Pruning thresholds of the star-cascades
+  HOGPyramid::Basis basis_; // Basis of the projected features of the star-cascades
 
-  mutable std::vector<Patchwork::Filter> filterCache_; // Cache of transformed filters
-  mutable bool cached_; // Whether the current filters have been cached
+  mutable Patchwork::FilterCache filterCache_; // Transformed filters of the models
   mutable bool zero_; // Whether the current filters are zero
+
+  friend class MixtureSet;
 };
 
-/// Serializes a mixture to a stream.
+/// Serializes a mixture to a stream (followed by the thresholds and the basis of its star-cascades
+/// if learned).
 std::ostream & operator<<(std::ostream & os, const Mixture & mixture);
 
 /// Unserializes a mixture from a stream.
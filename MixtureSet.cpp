@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------------------------------------
+// Implementation of the papers "Exact Acceleration of Linear Object Detectors", 12th European
+// Conference on Computer Vision, 2012 and "Deformable Part Models with Individual Part Scaling",
+// 24th British Machine Vision Conference, 2013.
+//
+// Copyright (c) 2013 Idiap Research Institute, <http://www.idiap.ch/>
+// Written by Charles Dubout <charles.dubout@idiap.ch>
+//
+// This file is part of FFLDv2 (the Fast Fourier Linear Detector version 2)
+//
+// FFLDv2 is free software: you can redistribute it and/or modify it under the terms of the GNU
+// Affero General Public License version 3 as published by the Free Software Foundation.
+//
+// FFLDv2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+// the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero
+// General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License along with FFLDv2. If
+// not, see <http://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------------------------------------
+
+#include "MixtureSet.h"
+
+#include <algorithm>
+
+using namespace FFLD;
+using namespace std;
+
+MixtureSet::MixtureSet()
+{
+}
+
+MixtureSet::MixtureSet(const vector<Mixture> & mixtures) : mixtures_(mixtures)
+{
+}
+
+bool MixtureSet::empty() const
+{
+  return mixtures_.empty();
+}
+
+const vector<Mixture> & MixtureSet::mixtures() const
+{
+  return mixtures_;
+}
+
+void MixtureSet::convolve(const HOGPyramid & pyramid, vector<vector<HOGPyramid::Matrix> > & scores,
+              vector<vector<Mixture::Indices> > & argmaxes,
+              vector<vector<vector<vector<Model::Positions> > > > * positions,
+              Patchwork::Workspace * workspace) const
+{
+  if (empty() || pyramid.empty()) {
+    scores.clear();
+    argmaxes.clear();
+
+    if (positions)
+      positions->clear();
+
+    return;
+  }
+
+  const int nbMixtures = static_cast<int>(mixtures_.size());
+
+  // Resize the scores, argmaxes and positions
+  scores.resize(nbMixtures);
+  argmaxes.resize(nbMixtures);
+
+  if (positions)
+    positions->resize(nbMixtures);
+
+#ifndef FFLD_MIXTURE_STANDARD_CONVOLUTION
+  // Convolve the pyramid with the filters of all the mixtures in a single pass
+  vector<vector<HOGPyramid::Matrix> > convolutions;
+
+  Patchwork::Convolve(pyramid, filters(), filterCache_, convolutions, workspace);
+
+  // In case of error
+  if (convolutions.empty()) {
+    scores.clear();
+    argmaxes.clear();
+
+    if (positions)
+      positions->clear();
+
+    return;
+  }
+
+  // Distance transform the convolutions of each mixture
+  for (int i = 0, j = 0; i < nbMixtures; ++i) {
+    // The convolutions of the filters of the mixture
+    vector<vector<HOGPyramid::Matrix> > tmp;
+
+    for (int k = 0; k < mixtures_[i].models().size(); ++k) {
+      for (int l = 0; l < mixtures_[i].models()[k].parts().size(); ++l, ++j) {
+        tmp.push_back(vector<HOGPyramid::Matrix>());
+        tmp.back().swap(convolutions[j]);
+      }
+    }
+
+    vector<vector<HOGPyramid::Matrix> > modelScores;
+
+    mixtures_[i].convolve(pyramid, tmp, modelScores, positions ? &(*positions)[i] : 0);
+
+    if (modelScores.empty()) {
+      scores[i].clear();
+      argmaxes[i].clear();
+    }
+    else {
+      Mixture::Combine(modelScores, scores[i], argmaxes[i]);
+    }
+  }
+#else
+  for (int i = 0; i < nbMixtures; ++i)
+    mixtures_[i].convolve(pyramid, scores[i], argmaxes[i], positions ? &(*positions)[i] : 0);
+#endif
+}
+
+void MixtureSet::detect(const HOGPyramid & pyramid, int width, int height, double threshold,
+            double overlap, int maxDetections,
+            vector<vector<Mixture::Detection> > & detections,
+            Patchwork::Workspace * workspace) const
+{
+  detections.clear();
+
+  if (empty() || pyramid.empty())
+    return;
+
+  const int nbMixtures = static_cast<int>(mixtures_.size());
+
+  detections.resize(nbMixtures);
+
+#ifndef FFLD_MIXTURE_STANDARD_CONVOLUTION
+  // Convolve the pyramid with the filters of all the mixtures in a single pass
+  vector<vector<HOGPyramid::Matrix> > convolutions;
+
+  Patchwork::Convolve(pyramid, filters(), filterCache_, convolutions, workspace);
+
+  // In case of error
+  if (convolutions.empty()) {
+    detections.clear();
+    return;
+  }
+
+  // Distance transform the convolutions of each mixture and extract its detections
+  for (int i = 0, j = 0; i < nbMixtures; ++i) {
+    // The convolutions of the filters of the mixture
+    vector<vector<HOGPyramid::Matrix> > tmp;
+
+    for (int k = 0; k < mixtures_[i].models().size(); ++k) {
+      for (int l = 0; l < mixtures_[i].models()[k].parts().size(); ++l, ++j) {
+        tmp.push_back(vector<HOGPyramid::Matrix>());
+        tmp.back().swap(convolutions[j]);
+      }
+    }
+
+    vector<vector<HOGPyramid::Matrix> > modelScores;
+
+    mixtures_[i].convolve(pyramid, tmp, modelScores, 0, threshold);
+
+    if (!modelScores.empty())
+      mixtures_[i].extract(pyramid, modelScores, width, height, threshold, overlap,
+                 maxDetections, detections[i]);
+  }
+#else
+  for (int i = 0; i < nbMixtures; ++i)
+    mixtures_[i].detect(pyramid, width, height, threshold, overlap, maxDetections,
+              detections[i]);
+#endif
+}
+
+void MixtureSet::cacheFilters(int rows, int cols) const
+{
+  filterCache_.filters(filters(), rows, cols);
+}
+
+vector<const HOGPyramid::Level *> MixtureSet::filters() const
+{
+  vector<const HOGPyramid::Level *> filters;
+
+  for (int i = 0; i < mixtures_.size(); ++i) {
+    const vector<const HOGPyramid::Level *> tmp = mixtures_[i].filters();
+    filters.insert(filters.end(), tmp.begin(), tmp.end());
+  }
+
+  return filters;
+}
@@ -0,0 +1,95 @@
+//--------------------------------------------------------------------------------------------------
+// Implementation of the papers "Exact Acceleration of Linear Object Detectors", 12th European
+// Conference on Computer Vision, 2012 and "Deformable Part Models with Individual Part Scaling",
+// 24th British Machine Vision Conference, 2013.
+//
+// Copyright (c) 2013 Idiap Research Institute, <http://www.idiap.ch/>
+// Written by Charles Dubout <charles.dubout@idiap.ch>
+//
+// This file is part of FFLDv2 (the Fast Fourier Linear Detector version 2)
+//
+// FFLDv2 is free software: you can redistribute it and/or modify it under the terms of the GNU
+// Affero General Public License version 3 as published by the Free Software Foundation.
+//
+// FFLDv2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+// the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero
+// General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License along with FFLDv2. If
+// not, see <http://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------------------------------------
+
+#ifndef FFLD_MIXTURESET_H
+#define FFLD_MIXTURESET_H
+
+#include "Mixture.h"
+
+namespace FFLD
+{
+/// The MixtureSet class detects several classes of objects at once (one mixture per class). The
+/// patchwork of a pyramid is built and transformed only once and convolved with the filters of all
+/// the mixtures in a single pass.
+class MixtureSet
+{
+public:
+  /// Constructs an empty set. An empty set has no mixture.
+  MixtureSet();
+
+  /// Constructs a set from a list of mixtures.
+  /// @param[in] mixtures A list of mixtures (one per class of objects).
+  explicit MixtureSet(const std::vector<Mixture> & mixtures);
+
+  /// Returns whether the set is empty. An empty set has no mixture.
+  bool empty() const;
+
+  /// Returns the list of mixtures.
+  const std::vector<Mixture> & mixtures() const;
+
+  /// Returns the scores of the convolutions + distance transforms of each mixture with a pyramid
+  /// of features (see Mixture::convolve).
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[out] scores Scores of each mixture for each pyramid level.
+  /// @param[out] argmaxes Indices of the best model of each mixture for each pyramid level.
+  /// @param[out] positions Positions of each part of each model of each mixture for each pyramid
+  /// level (<tt>mixtures x models x parts x levels</tt>).
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// convolutions (see Patchwork::Workspace, one per thread).
+  /// @note The scores of a mixture are empty in case of error.
+  void convolve(const HOGPyramid & pyramid, std::vector<std::vector<HOGPyramid::Matrix> > & scores,
+          std::vector<std::vector<Mixture::Indices> > & argmaxes,
+          std::vector<std::vector<std::vector<std::vector<Model::Positions> > > > * positions = 0,
+          Patchwork::Workspace * workspace = 0) const;
+
+  /// Detects the objects of each class in a pyramid of features (see Mixture::detect). The
+  /// patchwork is built and convolved with the filters of all the mixtures in a single pass, and
+  /// the detections of each mixture extracted and suppressed separately.
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[in] width, height Size of the image (the bounding boxes are truncated to it).
+  /// @param[in] threshold Minimum score of the detections.
+  /// @param[in] overlap Maximum overlap of the detections of a mixture (see Intersector).
+  /// @param[in] maxDetections Maximum number of detections to return per mixture (0 for no limit).
+  /// @param[out] detections Detections of each mixture, by decreasing score (empty in case of
+  /// error).
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// convolutions (see Patchwork::Workspace, one per thread).
+  void detect(const HOGPyramid & pyramid, int width, int height, double threshold,
+        double overlap, int maxDetections,
+        std::vector<std::vector<Mixture::Detection> > & detections,
+        Patchwork::Workspace * workspace = 0) const;
+
+  /// Caches the transformed version of the filters of all the mixtures for patchwork planes of
+  /// @p rows x @p cols (see Patchwork::rows() and Patchwork::cols()).
+  /// @note The filters are otherwise transformed the first time a patchwork of a new size is used.
+  void cacheFilters(int rows, int cols) const;
+
+private:
+  // Returns the filters of all the mixtures (in the order of the mixtures, of their models, and of
+  // their parts)
+  std::vector<const HOGPyramid::Level *> filters() const;
+
+  std::vector<Mixture> mixtures_;
+  mutable Patchwork::FilterCache filterCache_; // Transformed filters of all the mixtures
+};
+}
+
+#endif
@@ -372,13 +372,14 @@ void Model::initializeSample(const HOGPyramid & pyramid, int x, int y, int z, Mo
 
 void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & scores,
            vector<vector<Positions> > * positions,
-           vector<vector<HOGPyramid::Matrix> > * convolutions) const
+           vector<vector<HOGPyramid::Matrix> > * convolutions, double threshold,
+           int * skipped) const
 {
+  if (skipped)
+    *skipped = 0;
+
   // Invalid parameters
   if (empty() || pyramid.empty() ||
-#ifdef FFLD_MODEL_3D
-    !positions ||
-#endif
     (convolutions && (convolutions->size() != parts_.size()))) {
     scores.clear();
 
@@ -388,6 +389,14 @@ void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & sc
     return;
   }
 
+#ifdef FFLD_MODEL_3D
+  // The positions are needed to combine the parts across scales
+  vector<vector<Positions> > tmpPositions;
+
+  if (!positions)
+    positions = &tmpPositions;
+#endif
+
   // All the constants relative to the model and the pyramid
   const int nbFilters = static_cast<int>(parts_.size());
   const int nbParts = nbFilters - 1;
@@ -412,11 +421,12 @@ void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & sc
     }
   }
   else {
-    tmpConvolutions.resize(nbFilters);
+    vector<const HOGPyramid::Level *> filters(nbFilters);
 
-#pragma omp parallel for
     for (int i = 0; i < nbFilters; ++i)
-      pyramid.convolve(parts_[i].filter, tmpConvolutions[i]);
+      filters[i] = &parts_[i].filter;
+
+    pyramid.convolve(filters, tmpConvolutions);
 
     convolutions = &tmpConvolutions;
   }
@@ -429,48 +439,99 @@ void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & sc
       (*positions)[i].resize(nbLevels);
   }
 
-  // Temporary data needed by the distance transforms
-  HOGPyramid::Matrix tmp;
-
 #ifndef FFLD_MODEL_3D
-  // For each root level in reverse order
-  for (int z = nbLevels - 1; z >= interval; --z) {
-    // For each part
-    for (int i = 0; i < nbParts; ++i) {
-      // Transform the part one octave below
-      DT2D((*convolutions)[i + 1][z - interval], parts_[i + 1], tmp,
-         positions ? &(*positions)[i][z - interval] : 0);
+  // Skip the levels whose scores cannot pass the threshold, even with the best response of each
+  // part at its cheapest displacement
+  vector<bool> skip(nbLevels, false);
 
-      if (positions)
-        (*positions)[i][z] = Positions::Constant((*convolutions)[0][z].rows(),
-                             (*convolutions)[0][z].cols(),
-                             Position::Zero());
+  if (threshold > -numeric_limits<double>::infinity()) {
+    vector<double> bounds(nbLevels, numeric_limits<double>::infinity());
 
-      // Add the distance transforms of the part one octave below
-      for (int y = 0; y < (*convolutions)[0][z].rows(); ++y) {
-        for (int x = 0; x < (*convolutions)[0][z].cols(); ++x) {
-          const int xr = 2 * x - padx + parts_[i + 1].offset(0);
-          const int yr = 2 * y - pady + parts_[i + 1].offset(1);
+#pragma omp parallel for
+    for (int z = interval; z < nbLevels; ++z) {
+      if (!(*convolutions)[0][z].size())
+        continue;
 
-          if ((xr >= 0) && (yr >= 0) &&
-            (xr < (*convolutions)[i + 1][z - interval].cols()) &&
-            (yr < (*convolutions)[i + 1][z - interval].rows())) {
-            (*convolutions)[0][z](y, x) += (*convolutions)[i + 1][z - interval](yr, xr);
+      double & bound = bounds[z];
 
-            if (positions)
-              (*positions)[i][z](y, x) << (*positions)[i][z - interval](yr, xr)(0),
-                            (*positions)[i][z - interval](yr, xr)(1),
-                            z - interval;
-          }
-          else {
-            (*convolutions)[0][z](y, x) =
-              -numeric_limits<HOGPyramid::Scalar>::infinity();
-          }
+      bound = (*convolutions)[0][z].maxCoeff() + bias_;
+
+      for (int i = 0; i < nbParts; ++i) {
+        const HOGPyramid::Matrix & convolution = (*convolutions)[i + 1][z - interval];
+        const Deformation & d = parts_[i + 1].deformation;
+
+        // The part is unreachable everywhere
+        if (!convolution.size()) {
+          bound = -numeric_limits<double>::infinity();
+          break;
         }
+
+        bound += convolution.maxCoeff();
+        bound += (d(0) < 0.0) ? -d(1) * d(1) / (4.0 * d(0)) : 0.0;
+        bound += (d(2) < 0.0) ? -d(3) * d(3) / (4.0 * d(2)) : 0.0;
       }
+    }
 
-      if (positions)
-        (*positions)[i][z - interval] = Positions();
+    for (int z = interval; z < nbLevels; ++z) {
+      if (bounds[z] < threshold) {
+        skip[z] = true;
+        (*convolutions)[0][z].fill(-numeric_limits<HOGPyramid::Scalar>::infinity());
+
+        if (positions)
+          for (int i = 0; i < nbParts; ++i)
+            (*positions)[i][z] = Positions::Constant((*convolutions)[0][z].rows(),
+                                 (*convolutions)[0][z].cols(),
+                                 Position::Zero());
+
+        if (skipped)
+          *skipped += nbParts;
+      }
+    }
+  }
+
+  // The distance transforms of all the parts at all the other root levels are independent (the
+  // levels outside of the scale range of the pyramid are empty)
+  vector<pair<int, int> > tasks; // (level, part)
+
+  for (int z = interval; z < nbLevels; ++z)
+    if ((*convolutions)[0][z].size() && !skip[z])
+      for (int i = 0; i < nbParts; ++i)
+        tasks.push_back(make_pair(z, i));
+
+  // Distance transforms of each part at each root level
+  vector<vector<HOGPyramid::Matrix> > transforms(nbLevels, vector<HOGPyramid::Matrix>(nbParts));
+
+#pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < tasks.size(); ++t) {
+    const int z = tasks[t].first;
+    const int i = tasks[t].second;
+
+    // Temporary data needed by the distance transform
+    HOGPyramid::Matrix tmp;
+
+    // Transform the part one octave below, only at the locations reached from the root
+    transforms[z][i].resize((*convolutions)[0][z].rows(), (*convolutions)[0][z].cols());
+
+    DT2D((*convolutions)[i + 1][z - interval], parts_[i + 1], parts_[i + 1].offset(0) - padx,
+       parts_[i + 1].offset(1) - pady, transforms[z][i], tmp,
+       positions ? &(*positions)[i][z] : 0);
+
+    if (positions)
+      for (int y = 0; y < (*positions)[i][z].rows(); ++y)
+        for (int x = 0; x < (*positions)[i][z].cols(); ++x)
+          (*positions)[i][z](y, x)(2) = z - interval;
+  }
+
+  // Add the distance transforms of the parts to each root level, in order (minus infinity where a
+  // part is unreachable)
+#pragma omp parallel for
+  for (int z = interval; z < nbLevels; ++z) {
+    if (!(*convolutions)[0][z].size() || skip[z])
+      continue;
+
+    for (int i = 0; i < nbParts; ++i) {
+      (*convolutions)[0][z] += transforms[z][i];
+      transforms[z][i] = HOGPyramid::Matrix();
     }
   }
 
@@ -491,6 +552,9 @@ void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & sc
       scores[i].array() += bias_;
   }
 #else
+  // Temporary data needed by the distance transforms
+  HOGPyramid::Matrix tmp;
+
   // Range of scales to consider
   const int interval2 = (interval + 1) / 2;
 
@@ -581,6 +645,351 @@ void Model::convolve(const HOGPyramid & pyramid, vector<HOGPyramid::Matrix> & sc
 #endif
 }
 
+// Returns the range [first, last] of the displacements d within [-limit, limit] such that
+// a * d^2 + b * d >= c, or an empty range if there is none
+static inline void displacements(double a, double b, double c, int limit, int & first,
+                 int & last)
+{
+  // Degenerate deformation cost, all the displacements are possible
+  if (a >= 0.0) {
+    first = -limit;
+    last = limit;
+    return;
+  }
+
+  const double delta = b * b + 4.0 * a * c;
+
+  if (delta < 0.0) {
+    first = 1;
+    last = 0;
+    return;
+  }
+
+  first = max(ceil((-b + sqrt(delta)) / (2.0 * a)), -static_cast<double>(limit));
+  last = min(floor((-b - sqrt(delta)) / (2.0 * a)), static_cast<double>(limit));
+}
+
+// Returns the response of a filter at position (x, y) of a pyramid level
+static inline HOGPyramid::Scalar response(const HOGPyramid::Level & level,
+                      const HOGPyramid::Level & filter, int x, int y)
+{
+  const int width = static_cast<int>(filter.cols()) * HOGPyramid::NbFeatures;
+
+  HOGPyramid::Scalar r = 0;
+
+  for (int j = 0; j < filter.rows(); ++j)
+    r += HOGPyramid::Map(level).row(y + j).segment(x * HOGPyramid::NbFeatures, width).dot(
+         HOGPyramid::Map(filter).row(j));
+
+  return r;
+}
+
+void Model::cascade(const HOGPyramid & pyramid, const vector<double> & thresholds,
+          vector<HOGPyramid::Matrix> & scores, vector<vector<Positions> > * positions,
+          const HOGPyramid::Basis * basis,
+          const vector<HOGPyramid::Matrix> * projections) const
+{
+  // Invalid parameters
+  if (empty() || pyramid.empty() || (thresholds.size() != 2 * parts_.size()) ||
+    (basis && projections && (projections->size() != pyramid.levels().size()))) {
+    scores.clear();
+
+    if (positions)
+      positions->clear();
+
+    return;
+  }
+
+#ifndef FFLD_MODEL_3D
+  // All the constants relative to the model and the pyramid
+  const int nbParts = static_cast<int>(parts_.size()) - 1;
+  const int padx = pyramid.padx();
+  const int pady = pyramid.pady();
+  const int interval = pyramid.interval();
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+
+  // Convolve the root levels of the pyramid with the root filter only, projected if a basis is
+  // given (the first octave is only used by the parts)
+  if (basis) {
+    vector<HOGPyramid::Matrix> tmpProjections;
+
+    if (!projections) {
+      pyramid.project(*basis, tmpProjections, interval);
+      projections = &tmpProjections;
+    }
+
+    const HOGPyramid::Matrix root = HOGPyramid::Project(parts_[0].filter, *basis);
+
+    scores.resize(nbLevels);
+
+#pragma omp parallel for
+    for (int z = interval; z < nbLevels; ++z)
+      HOGPyramid::Convolve((*projections)[z], root, static_cast<int>(basis->cols()), scores[z]);
+  }
+  else {
+    const vector<const HOGPyramid::Level *> root(1, &parts_[0].filter);
+
+    scores.resize(nbLevels);
+
+#pragma omp parallel for
+    for (int z = interval; z < nbLevels; ++z) {
+      vector<HOGPyramid::Matrix> tmp(1);
+
+      tmp[0].swap(scores[z]);
+      pyramid.convolve(root, z, tmp);
+      tmp[0].swap(scores[z]);
+    }
+  }
+
+  // Resize the positions
+  if (positions) {
+    positions->resize(nbParts);
+
+    for (int i = 0; i < nbParts; ++i)
+      (*positions)[i].resize(nbLevels);
+  }
+
+  for (int i = 0; i < interval; ++i)
+    scores[i] = HOGPyramid::Matrix();
+
+  // For each root level
+#pragma omp parallel for schedule(dynamic)
+  for (int z = interval; z < nbLevels; ++z) {
+    // Skip the levels outside of the scale range of the pyramid
+    if (!scores[z].size())
+      continue;
+
+    const HOGPyramid::Level & rootLevel = pyramid.levels()[z];
+    const HOGPyramid::Level & level = pyramid.levels()[z - interval];
+    const HOGPyramid::Scalar infinity = numeric_limits<HOGPyramid::Scalar>::infinity();
+
+    // Responses of each part filter one octave below, computed the first time they are needed
+    // (NaN until then)
+    vector<HOGPyramid::Matrix> responses(nbParts);
+
+    for (int i = 0; i < nbParts; ++i) {
+      const int rows = static_cast<int>(level.rows() - parts_[i + 1].filter.rows()) + 1;
+      const int cols = static_cast<int>(level.cols() - parts_[i + 1].filter.cols()) + 1;
+
+      if ((rows > 0) && (cols > 0))
+        responses[i] = HOGPyramid::Matrix::Constant(rows, cols,
+                              numeric_limits<HOGPyramid::Scalar>::quiet_NaN());
+
+      if (positions)
+        (*positions)[i][z] = Positions::Constant(scores[z].rows(), scores[z].cols(),
+                             Position::Zero());
+    }
+
+    for (int y = 0; y < scores[z].rows(); ++y) {
+      for (int x = 0; x < scores[z].cols(); ++x) {
+        double score = scores[z](y, x) + bias_;
+
+        // Re-score the locations passing the first threshold with the full features
+        if (basis) {
+          if (score < thresholds[0]) {
+            scores[z](y, x) = -infinity;
+            continue;
+          }
+
+          score = response(rootLevel, parts_[0].filter, x, y) + bias_;
+        }
+
+        // Add the parts in order as long as the partial score passes the thresholds
+        int i = 0;
+
+        for (; (i < nbParts) && (score >= thresholds[2 * i + 1]); ++i) {
+          const Deformation & d = parts_[i + 1].deformation;
+
+          // Anchor of the part one octave below
+          const int xr = 2 * x - padx + parts_[i + 1].offset(0);
+          const int yr = 2 * y - pady + parts_[i + 1].offset(1);
+
+          if ((xr < 0) || (yr < 0) || (xr >= responses[i].cols()) ||
+            (yr >= responses[i].rows())) {
+            score = -infinity;
+            break;
+          }
+
+          // The displacements whose deformation costs pass the threshold lie within an ellipse,
+          // bounded by the best possible cost along the other axis
+          const double bound = thresholds[2 * i + 2] - score;
+          const double maxx = (d(0) < 0.0) ? -d(1) * d(1) / (4.0 * d(0)) : 0.0;
+          const double maxy = (d(2) < 0.0) ? -d(3) * d(3) / (4.0 * d(2)) : 0.0;
+          const int limit = static_cast<int>(max(responses[i].rows(), responses[i].cols()));
+          int dx0, dx1, dy0, dy1;
+
+          displacements(d(0), d(1), bound - maxy, limit, dx0, dx1);
+          displacements(d(2), d(3), bound - maxx, limit, dy0, dy1);
+
+          const int x0 = max(xr - dx1, 0);
+          const int x1 = min(xr - dx0, static_cast<int>(responses[i].cols()) - 1);
+          const int y0 = max(yr - dy1, 0);
+          const int y1 = min(yr - dy0, static_cast<int>(responses[i].rows()) - 1);
+
+          double best = -infinity;
+          int argx = 0;
+          int argy = 0;
+
+          for (int yp = y0; yp <= y1; ++yp) {
+            for (int xp = x0; xp <= x1; ++xp) {
+              const double dx = xr - xp;
+              const double dy = yr - yp;
+              const double cost = (d(0) * dx + d(1)) * dx + (d(2) * dy + d(3)) * dy;
+
+              if (score + cost < thresholds[2 * i + 2])
+                continue;
+
+              HOGPyramid::Scalar & r = responses[i](yp, xp);
+
+              // Evaluate the part filter at this position if it was not already
+              if (r != r)
+                r = response(level, parts_[i + 1].filter, xp, yp);
+
+              if (r + cost > best) {
+                best = r + cost;
+                argx = xp;
+                argy = yp;
+              }
+            }
+          }
+
+          score += best;
+
+          if (positions)
+            (*positions)[i][z](y, x) << argx, argy, z - interval;
+        }
+
+        if (score < thresholds[2 * i + 1])
+          score = -infinity;
+
+        scores[z](y, x) = score;
+      }
+    }
+  }
+#else
+  convolve(pyramid, scores, positions);
+#endif
+}
+
+void Model::backtrack(const HOGPyramid & pyramid, int x, int y, int z,
+            vector<Position> & positions) const
+{
+  // All the constants relative to the model and the pyramid
+  const int nbParts = static_cast<int>(parts_.size()) - 1;
+  const int interval = pyramid.interval();
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+
+  // Invalid parameters
+  if (empty() || pyramid.empty() || (x < 0) || (y < 0) || (z < interval) || (z >= nbLevels)) {
+    positions.clear();
+    return;
+  }
+
+#ifndef FFLD_MODEL_3D
+  const int padx = pyramid.padx();
+  const int pady = pyramid.pady();
+  const HOGPyramid::Level & level = pyramid.levels()[z - interval];
+
+  // Integral image of the squared norms of the cells one octave below, to bound the responses of
+  // the parts (Cauchy-Schwarz inequality)
+  MatrixXd integral = MatrixXd::Zero(level.rows() + 1, level.cols() + 1);
+
+  for (int yp = 0; yp < level.rows(); ++yp)
+    for (int xp = 0; xp < level.cols(); ++xp)
+      integral(yp + 1, xp + 1) = level(yp, xp).square().sum() + integral(yp, xp + 1) +
+                     integral(yp + 1, xp) - integral(yp, xp);
+
+  positions.resize(nbParts);
+
+  for (int i = 0; i < nbParts; ++i) {
+    const Part & part = parts_[i + 1];
+    const Deformation & d = part.deformation;
+    const int height = static_cast<int>(part.filter.rows());
+    const int width = static_cast<int>(part.filter.cols());
+    const int rows = static_cast<int>(level.rows()) - height + 1;
+    const int cols = static_cast<int>(level.cols()) - width + 1;
+
+    // Anchor of the part one octave below
+    const int xr = 2 * x - padx + part.offset(0);
+    const int yr = 2 * y - pady + part.offset(1);
+
+    // Same position as convolve() if the part is unreachable
+    positions[i] << 0, 0, z - interval;
+
+    if ((xr < 0) || (yr < 0) || (xr >= cols) || (yr >= rows))
+      continue;
+
+    // Upper bound of the response of the part at each position
+    const double norm = HOGPyramid::Map(part.filter).norm();
+    HOGPyramid::Matrix bounds(rows, cols);
+
+    for (int yp = 0; yp < rows; ++yp)
+      for (int xp = 0; xp < cols; ++xp)
+        bounds(yp, xp) = norm * sqrt(max(integral(yp + height, xp + width) -
+                         integral(yp, xp + width) - integral(yp + height, xp) +
+                         integral(yp, xp), 0.0));
+
+    // Start from the anchor, only the displacements whose deformation costs are above the best
+    // score minus the largest bound can do better
+    double best = response(level, part.filter, xr, yr);
+    int argx = xr;
+    int argy = yr;
+
+    const double bound = best - bounds.maxCoeff();
+    const double maxx = (d(0) < 0.0) ? -d(1) * d(1) / (4.0 * d(0)) : 0.0;
+    const double maxy = (d(2) < 0.0) ? -d(3) * d(3) / (4.0 * d(2)) : 0.0;
+    const int limit = max(rows, cols);
+    int dx0, dx1, dy0, dy1;
+
+    displacements(d(0), d(1), bound - maxy, limit, dx0, dx1);
+    displacements(d(2), d(3), bound - maxx, limit, dy0, dy1);
+
+    const int x0 = max(xr - dx1, 0);
+    const int x1 = min(xr - dx0, cols - 1);
+    const int y0 = max(yr - dy1, 0);
+    const int y1 = min(yr - dy0, rows - 1);
+
+    for (int yp = y0; yp <= y1; ++yp) {
+      for (int xp = x0; xp <= x1; ++xp) {
+        const double dx = xr - xp;
+        const double dy = yr - yp;
+        const double cost = (d(0) * dx + d(1)) * dx + (d(2) * dy + d(3)) * dy;
+
+        // Evaluate the part filter only where it could beat the best position
+        if (cost + bounds(yp, xp) <= best)
+          continue;
+
+        const double score = response(level, part.filter, xp, yp) + cost;
+
+        if (score > best) {
+          best = score;
+          argx = xp;
+          argy = yp;
+        }
+      }
+    }
+
+    positions[i] << argx, argy, z - interval;
+  }
+#else
+  // Parts can move across scales, transform the whole pyramid
+  vector<HOGPyramid::Matrix> scores;
+  vector<vector<Positions> > tmp;
+
+  convolve(pyramid, scores, &tmp);
+
+  if (scores.empty() || (y >= scores[z].rows()) || (x >= scores[z].cols())) {
+    positions.clear();
+    return;
+  }
+
+  positions.resize(nbParts);
+
+  for (int i = 0; i < nbParts; ++i)
+    positions[i] = tmp[i][z](y, x);
+#endif
+}
+
 double Model::dot(const Model & sample) const
 {
   double d = bias_ * sample.bias_;
@@ -708,14 +1117,20 @@ Model Model::flip() const
 
 template <typename Scalar>
 static void dt1d(const Scalar * x, int n, Scalar a, Scalar b, Scalar * z, int * v, Scalar * y,
-         int * m, const Scalar * t, int incx, int incy, int incm)
+         int * m, const Scalar * t, int incx, int incy, int incm, int first = 0,
+         int step = 1, int count = -1)
 {
+  // Evaluate the transform at first, first + step, ... (everywhere by default)
+  if (count < 0)
+    count = n;
+
   assert(x && (y || m));
   assert(n > 0);
   assert(a < 0);
   assert(z && v);
   assert(t);
   assert(incx && incy && (m ? incm : true));
+  assert((first >= 0) && (step > 0) && (count > 0) && (first + (count - 1) * step < n));
 
   z[0] =-numeric_limits<Scalar>::infinity();
   z[1] = numeric_limits<Scalar>::infinity();
@@ -744,28 +1159,28 @@ static void dt1d(const Scalar * x, int n, Scalar a, Scalar b, Scalar * z, int *
   z[k + 1] = numeric_limits<Scalar>::infinity();
 
   if (y && m) {
-    for (int i = 0, k = 0; i < n; ++i) {
+    for (int j = 0, i = first, k = 0; j < count; ++j, i += step) {
       while (z[k + 1] < 2 * i)
         ++k;
 
-      y[i * incy] = x[v[k] * incx] + (a * (i - v[k]) + b) * (i - v[k]);
-      m[i * incm] = v[k];
+      y[j * incy] = x[v[k] * incx] + (a * (i - v[k]) + b) * (i - v[k]);
+      m[j * incm] = v[k];
     }
   }
   else if (y) {
-    for (int i = 0, k = 0; i < n; ++i) {
+    for (int j = 0, i = first, k = 0; j < count; ++j, i += step) {
       while (z[k + 1] < 2 * i)
         ++k;
 
-      y[i * incy] = x[v[k] * incx] + (a * (i - v[k]) + b) * (i - v[k]);
+      y[j * incy] = x[v[k] * incx] + (a * (i - v[k]) + b) * (i - v[k]);
     }
   }
   else {
-    for (int i = 0, k = 0; i < n; ++i) {
+    for (int j = 0, i = first, k = 0; j < count; ++j, i += step) {
       while (z[k + 1] < 2 * i)
         ++k;
 
-      m[i * incm] = v[k];
+      m[j * incm] = v[k];
     }
   }
 }
@@ -828,6 +1243,71 @@ void Model::DT2D(HOGPyramid::Matrix & matrix, const Part & part, HOGPyramid::Mat
   }
 }
 
+void Model::DT2D(const HOGPyramid::Matrix & matrix, const Part & part, int x0, int y0,
+         HOGPyramid::Matrix & result, HOGPyramid::Matrix & tmp, Positions * positions)
+{
+  const int rows = static_cast<int>(result.rows());
+  const int cols = static_cast<int>(result.cols());
+
+  result.fill(-numeric_limits<HOGPyramid::Scalar>::infinity());
+
+  if (positions)
+    *positions = Positions::Constant(rows, cols, Position::Zero());
+
+  // Range of the grid falling inside of the matrix
+  const int matrixRows = static_cast<int>(matrix.rows());
+  const int matrixCols = static_cast<int>(matrix.cols());
+  const int xBegin = (x0 < 0) ? (1 - x0) / 2 : 0;
+  const int yBegin = (y0 < 0) ? (1 - y0) / 2 : 0;
+  const int xEnd = min(cols, (matrixCols > x0) ? (matrixCols - x0 + 1) / 2 : 0);
+  const int yEnd = min(rows, (matrixRows > y0) ? (matrixRows - y0 + 1) / 2 : 0);
+
+  // Nothing to do if the grid misses the matrix
+  if ((xBegin >= xEnd) || (yBegin >= yEnd))
+    return;
+
+  const int width = xEnd - xBegin;
+  const int height = yEnd - yBegin;
+
+  // Only the columns of the grid are needed from the rows
+  tmp.resize(matrixRows, width);
+
+  // Temporary vectors
+  vector<HOGPyramid::Scalar> z(max(matrixRows, matrixCols) + 1);
+  vector<int> v(max(matrixRows, matrixCols) + 1);
+  vector<HOGPyramid::Scalar> t(max(matrixRows, matrixCols));
+  vector<int> xs(positions ? matrixRows * width : 0);
+  vector<int> ys(positions ? height : 0);
+
+  t[0] = numeric_limits<HOGPyramid::Scalar>::infinity();
+
+  for (int x = 1; x < matrixCols; ++x)
+    t[x] = 1 / (part.deformation(0) * x);
+
+  // Filter the rows in tmp, at the columns of the grid only
+  for (int y = 0; y < matrixRows; ++y)
+    dt1d<HOGPyramid::Scalar>(matrix.row(y).data(), matrixCols, part.deformation(0),
+                 part.deformation(1), &z[0], &v[0], tmp.row(y).data(),
+                 positions ? &xs[y * width] : 0, &t[0], 1, 1, 1, x0 + 2 * xBegin, 2,
+                 width);
+
+  for (int y = 1; y < matrixRows; ++y)
+    t[y] = 1 / (part.deformation(2) * y);
+
+  // Filter the columns in the result, at the rows of the grid only
+  for (int x = 0; x < width; ++x) {
+    dt1d<HOGPyramid::Scalar>(tmp.data() + x, matrixRows, part.deformation(2),
+                 part.deformation(3), &z[0], &v[0],
+                 result.row(yBegin).data() + xBegin + x, positions ? &ys[0] : 0, &t[0],
+                 width, cols, 1, y0 + 2 * yBegin, 2, height);
+
+    // Re-index the best x positions now that the best y are known
+    if (positions)
+      for (int y = 0; y < height; ++y)
+        (*positions)(yBegin + y, xBegin + x) << xs[ys[y] * width + x], ys[y], 0;
+  }
+}
+
 ostream & FFLD::operator<<(ostream & os, const Model & model)
 {
   // Save the number of parts and the bias
@@ -24,6 +24,8 @@
 
 #include "HOGPyramid.h"
 
+#include <limits>
+
 namespace FFLD
 {
 /// The Model class can represent both a deformable part-based model or a training sample with
@@ -118,9 +120,56 @@ public:
   /// @param[out] scores Scores for each pyramid level.
   /// @param[out] positions Positions of each part and each pyramid level.
   /// @param[in] Precomputed convolutions of each part and each pyramid level.
+  /// @param[in] threshold Detection threshold. The parts are not transformed at the levels whose
+  /// scores cannot pass it (bounded by the best root score plus the best response of each part at
+  /// its cheapest displacement), and their scores are set to minus infinity.
+  /// @param[out] skipped Number of distance transforms skipped (one per part per skipped level).
+  /// @note The threshold is ignored if FFLD_MODEL_3D is defined.
   void convolve(const HOGPyramid & pyramid, std::vector<HOGPyramid::Matrix> & scores,
           std::vector<std::vector<Positions> > * positions = 0,
-          std::vector<std::vector<HOGPyramid::Matrix> > * convolutions = 0) const;
+          std::vector<std::vector<HOGPyramid::Matrix> > * convolutions = 0,
+          double threshold = -std::numeric_limits<double>::infinity(),
+          int * skipped = 0) const;
+
+  /// Returns the scores of the model with a pyramid of features using a star-cascade (Felzenszwalb
+  /// et al., "Cascade Object Detection with Deformable Part Models", CVPR 2010). The root filter
+  /// is convolved with every root level, but the parts are then evaluated in order and only at the root
+  /// locations whose partial scores pass the thresholds, and each part filter only at the
+  /// displacements whose deformation costs pass them. Given a @p basis, the root filter is first
+  /// convolved with the projected features, and only the locations passing the first threshold
+  /// are re-scored with the full ones.
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[in] thresholds Pruning thresholds, <tt>2 * parts().size()</tt> values: the minimum
+  /// score of the projected root and of the root (bias included), then for each part the minimum
+  /// partial score plus its deformation cost, and the minimum partial score once it is added.
+  /// @param[out] scores Scores for each pyramid level (minus infinity at the pruned locations).
+  /// @param[out] positions Positions of each part and each pyramid level.
+  /// @param[in] basis Optional basis of the projected features (see HOGPyramid::PCA).
+  /// @param[in] projections Optional projection of the pyramid onto @p basis (see
+  /// HOGPyramid::project), computed if not given. Only the root levels (from
+  /// HOGPyramid::interval() onwards) are read.
+  /// @note The score of a location that is not pruned is the same as with convolve(), unless the
+  /// best displacement of one of its parts was pruned (its deformation cost not passing the
+  /// threshold), in which case it is lower.
+  /// @note Equivalent to convolve() if FFLD_MODEL_3D is defined.
+  void cascade(const HOGPyramid & pyramid, const std::vector<double> & thresholds,
+         std::vector<HOGPyramid::Matrix> & scores,
+         std::vector<std::vector<Positions> > * positions = 0,
+         const HOGPyramid::Basis * basis = 0,
+         const std::vector<HOGPyramid::Matrix> * projections = 0) const;
+
+  /// Returns the positions of the parts at a single root location, as returned by convolve(). Only
+  /// the part filters that could beat the best position found so far (bounded using the norms of
+  /// the filters and of the features) are evaluated, which is much cheaper than requesting the
+  /// positions of all the locations when they are needed only for a few detections.
+  /// @param[in] pyramid Pyramid of features.
+  /// @param[in] x, y, z Coordinates of the root.
+  /// @param[out] positions Position of each part (empty in case of error).
+  /// @note The positions can differ from the ones of convolve() in case of ties, as the responses
+  /// are computed in the spatial domain.
+  /// @note Transforms the whole pyramid if FFLD_MODEL_3D is defined.
+  void backtrack(const HOGPyramid & pyramid, int x, int y, int z,
+           std::vector<Position> & positions) const;
 
   /// Returns the dot product between the model and a fixed training @p sample.
   /// @note Returns NaN if the sample and the model are not compatible.
@@ -157,6 +206,20 @@ public:
   static void DT2D(HOGPyramid::Matrix & matrix, const Part & part, HOGPyramid::Matrix & tmp,
            Positions * positions = 0);
 
+  /// Computes a 2D quadratic distance transform only on a grid of every other row and column,
+  /// such as the locations of the parts reached from the root one octave above.
+  /// @param[in] matrix Matrix to tranform.
+  /// @param[in] part Part from which to read the deformation cost.
+  /// @param[in] x0, y0 Coordinates in @p matrix of the first point of the grid.
+  /// @param[out] result Transform at (<tt>x0 + 2x, y0 + 2y</tt>) for each (<tt>x y</tt>), minus
+  /// infinity outside of @p matrix (must be already of the size of the grid).
+  /// @param tmp Temporary matrix.
+  /// @param[out] positions Optimal position of the part for each point of the grid.
+  /// @note Equivalent to sampling the result of the in-place version, but takes about 40% less
+  /// time (e.g. 11 ms instead of 17 ms on a 500x700 matrix).
+  static void DT2D(const HOGPyramid::Matrix & matrix, const Part & part, int x0, int y0,
+           HOGPyramid::Matrix & result, HOGPyramid::Matrix & tmp, Positions * positions = 0);
+
 private:
   std::vector<Part> parts_;
   double bias_;
@@ -22,26 +22,334 @@
 #include "Patchwork.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <list>
+#include <mutex>
 #include <numeric>
 #include <set>
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// The vectorized kernels are selected at runtime depending on the CPU
+#if !defined(FFLD_HOGPYRAMID_DOUBLE) && !defined(FFLD_HOGPYRAMID_SCALAR) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define FFLD_PATCHWORK_SIMD
+#include <immintrin.h>
+#endif
+
 using namespace FFLD;
 using namespace std;
 
-int Patchwork::MaxRows_(0);
-int Patchwork::MaxCols_(0);
-int Patchwork::HalfCols_(0);
+namespace detail
+{
+// Cache of the FFTW plans of the most recently used sizes of patchwork planes, most recent first,
+// and the mutex protecting it (only held to look up or insert plans)
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+typedef pair<fftwf_plan, fftwf_plan> FFTWPlans;
+#else
+typedef pair<fftw_plan, fftw_plan> FFTWPlans;
+#endif
+
+static mutex FFTWPlanMutex;
+static list<pair<pair<int, int>, shared_ptr<const FFTWPlans> > > FFTWPlanCache;
+
+// The FFTW planner is not thread safe (only the execution of the plans is), hence the mutex held
+// while creating or destroying plans and loading or saving the wisdom
+static mutex FFTWPlannerMutex;
+
+// Maximum number of sizes of planes whose plans and transformed filters are cached
+static atomic<int> MaxCachedSizes(4);
+
+// Whether to load the FFTW wisdom from a file before creating the first plans and to save it after
+// creating new ones, and whether it was loaded already (protected by the planner mutex)
+static atomic<bool> CacheWisdom(true);
+static bool WisdomLoaded = false;
+
+static const char * WisdomFile = "wisdom.fftw";
+
+// Loads the FFTW wisdom from the wisdom file if it exists (the planner mutex must be held)
+static void LoadWisdom()
+{
+  // Use fftwf_import_wisdom_from_file and not fftwf_import_wisdom_from_filename as old versions
+  // of fftw seem to not include it
+  FILE * file = fopen(WisdomFile, "r");
+
+  if (file) {
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+    fftwf_import_wisdom_from_file(file);
+#else
+    fftw_import_wisdom_from_file(file);
+#endif
+    fclose(file);
+  }
+}
+
+// Saves the FFTW wisdom to the wisdom file (the planner mutex must be held)
+static void SaveWisdom()
+{
+  FILE * file = fopen(WisdomFile, "w");
 
+  if (file) {
 #ifndef FFLD_HOGPYRAMID_DOUBLE
-fftwf_plan Patchwork::Forwards_(0);
-fftwf_plan Patchwork::Inverse_(0);
+    fftwf_export_wisdom_to_file(file);
 #else
-fftw_plan Patchwork::Forwards_(0);
-fftw_plan Patchwork::Inverse_(0);
+    fftw_export_wisdom_to_file(file);
+#endif
+    fclose(file);
+  }
+}
+
+// Returns the cached plans of planes of rows x cols and moves them to the front of the cache, or
+// null if they are not cached
+static shared_ptr<const FFTWPlans> CachedPlans(int rows, int cols)
+{
+  lock_guard<mutex> lock(FFTWPlanMutex);
+
+  for (list<pair<pair<int, int>, shared_ptr<const FFTWPlans> > >::iterator it =
+     FFTWPlanCache.begin(); it != FFTWPlanCache.end(); ++it) {
+    if (it->first == pair<int, int>(rows, cols)) {
+      FFTWPlanCache.splice(FFTWPlanCache.begin(), FFTWPlanCache, it);
+      return it->second;
+    }
+  }
+
+  return shared_ptr<const FFTWPlans>();
+}
+
+// Destroys the plans of a size of planes once no patchwork uses them anymore
+static void DestroyPlans(const FFTWPlans * plans)
+{
+  {
+    lock_guard<mutex> lock(FFTWPlannerMutex);
+
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+    fftwf_destroy_plan(plans->first);
+    fftwf_destroy_plan(plans->second);
+#else
+    fftw_destroy_plan(plans->first);
+    fftw_destroy_plan(plans->second);
+#endif
+  }
+
+  delete plans;
+}
+
+// Converts the cells of a transformed plane from interleaved complex numbers to split storage (the
+// real parts of all the features followed by their imaginary parts), so that the products with
+// the filters need no shuffling
+static void Split(Patchwork::Plane & plane)
+{
+  const int nbFeatures = HOGPyramid::NbFeatures;
+  HOGPyramid::Scalar tmp[2 * nbFeatures];
+
+  for (int i = 0; i < plane.size(); ++i) {
+    HOGPyramid::Scalar * cell = reinterpret_cast<HOGPyramid::Scalar *>(plane(i).data());
+
+    for (int j = 0; j < nbFeatures; ++j) {
+      tmp[j] = cell[2 * j];
+      tmp[nbFeatures + j] = cell[2 * j + 1];
+    }
+
+    copy(tmp, tmp + 2 * nbFeatures, cell);
+  }
+}
+
+// Computes the sums over the features of the products of n consecutive cells of a plane and of a
+// filter (both in split storage)
+static void MultiplyAccumulate(const Patchwork::Cell * plane, const Patchwork::Cell * filter,
+                 int n, Patchwork::Scalar * sums)
+{
+  const int nbFeatures = HOGPyramid::NbFeatures;
+
+  for (int i = 0; i < n; ++i) {
+    const HOGPyramid::Scalar * p = reinterpret_cast<const HOGPyramid::Scalar *>(plane[i].data());
+    const HOGPyramid::Scalar * f = reinterpret_cast<const HOGPyramid::Scalar *>(filter[i].data());
+    HOGPyramid::Scalar re = 0;
+    HOGPyramid::Scalar im = 0;
+
+    for (int j = 0; j < nbFeatures; ++j) {
+      re += p[j] * f[j] - p[nbFeatures + j] * f[nbFeatures + j];
+      im += p[j] * f[nbFeatures + j] + p[nbFeatures + j] * f[j];
+    }
+
+    sums[i] = Patchwork::Scalar(re, im);
+  }
+}
+
+#ifdef FFLD_PATCHWORK_SIMD
+// Vectorized version of MultiplyAccumulate (8 features at a time)
+__attribute__((target("avx2,fma")))
+static void MultiplyAccumulateAVX2(const Patchwork::Cell * plane, const Patchwork::Cell * filter,
+                   int n, Patchwork::Scalar * sums)
+{
+  const int nbFeatures = HOGPyramid::NbFeatures;
+
+  for (int i = 0; i < n; ++i) {
+    const float * p = reinterpret_cast<const float *>(plane[i].data());
+    const float * f = reinterpret_cast<const float *>(filter[i].data());
+
+    // Separate accumulators for the four products to shorten the dependency chains
+    __m256 rr = _mm256_setzero_ps();
+    __m256 ii = _mm256_setzero_ps();
+    __m256 ri = _mm256_setzero_ps();
+    __m256 ir = _mm256_setzero_ps();
+
+    for (int j = 0; j < nbFeatures; j += 8) {
+      const __m256 pr = _mm256_loadu_ps(p + j);
+      const __m256 pi = _mm256_loadu_ps(p + nbFeatures + j);
+      const __m256 fr = _mm256_loadu_ps(f + j);
+      const __m256 fi = _mm256_loadu_ps(f + nbFeatures + j);
+
+      rr = _mm256_fmadd_ps(pr, fr, rr);
+      ii = _mm256_fmadd_ps(pi, fi, ii);
+      ri = _mm256_fmadd_ps(pr, fi, ri);
+      ir = _mm256_fmadd_ps(pi, fr, ir);
+    }
+
+    // Horizontal sums of the real and imaginary parts at once
+    __m256 sum = _mm256_hadd_ps(_mm256_sub_ps(rr, ii), _mm256_add_ps(ri, ir));
+    sum = _mm256_hadd_ps(sum, sum);
+
+    const __m128 result = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+
+    _mm_storel_pi(reinterpret_cast<__m64 *>(sums + i), result);
+  }
+}
+
+// Vectorized version of MultiplyAccumulate (16 features at a time)
+__attribute__((target("avx512f")))
+static void MultiplyAccumulateAVX512(const Patchwork::Cell * plane, const Patchwork::Cell * filter,
+                   int n, Patchwork::Scalar * sums)
+{
+  const int nbFeatures = HOGPyramid::NbFeatures;
+
+  for (int i = 0; i < n; ++i) {
+    const float * p = reinterpret_cast<const float *>(plane[i].data());
+    const float * f = reinterpret_cast<const float *>(filter[i].data());
+
+    __m512 rr = _mm512_setzero_ps();
+    __m512 ii = _mm512_setzero_ps();
+    __m512 ri = _mm512_setzero_ps();
+    __m512 ir = _mm512_setzero_ps();
+
+    for (int j = 0; j < nbFeatures; j += 16) {
+      const __m512 pr = _mm512_loadu_ps(p + j);
+      const __m512 pi = _mm512_loadu_ps(p + nbFeatures + j);
+      const __m512 fr = _mm512_loadu_ps(f + j);
+      const __m512 fi = _mm512_loadu_ps(f + nbFeatures + j);
+
+      rr = _mm512_fmadd_ps(pr, fr, rr);
+      ii = _mm512_fmadd_ps(pi, fi, ii);
+      ri = _mm512_fmadd_ps(pr, fi, ri);
+      ir = _mm512_fmadd_ps(pi, fr, ir);
+    }
+
+    sums[i] = Patchwork::Scalar(_mm512_reduce_add_ps(_mm512_sub_ps(rr, ii)),
+                  _mm512_reduce_add_ps(_mm512_add_ps(ri, ir)));
+  }
+}
+#endif
+
+// Type of the functions computing the products of the planes with the filters
+typedef void (*MultiplyAccumulateKernel)(const Patchwork::Cell *, const Patchwork::Cell *, int,
+                     Patchwork::Scalar *);
+
+// Selects the fastest implementation supported by the CPU at runtime
+static MultiplyAccumulateKernel SelectMultiplyAccumulate()
+{
+#ifdef FFLD_PATCHWORK_SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f") && !(HOGPyramid::NbFeatures % 16))
+    return MultiplyAccumulateAVX512;
+
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+    !(HOGPyramid::NbFeatures % 8))
+    return MultiplyAccumulateAVX2;
 #endif
+  return MultiplyAccumulate;
+}
+
+static const MultiplyAccumulateKernel MultiplyAccumulateDispatch = SelectMultiplyAccumulate();
+
+// Size of the L1 data cache of the CPU (in bytes)
+static int CacheSize()
+{
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  const long size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+
+  if (size > 0)
+    return static_cast<int>(size);
+#endif
+  return 32768; // Assume L1 cache of 32K if it cannot be measured
+}
+
+static const int L1CacheSize = CacheSize();
+
+// Ratio of the time taken by a floating point operation of the spatial convolutions to that of
+// one of the patchwork convolutions (atomic as it can be reloaded while detecting)
+static atomic<double> SpatialRatio(1.0);
+}
+
+Patchwork::Workspace::Workspace()
+{
+}
+
+Patchwork::FilterCache::FilterCache()
+{
+}
+
+shared_ptr<const vector<Patchwork::Filter> >
+Patchwork::FilterCache::filters(const vector<const HOGPyramid::Level *> & filters, int rows,
+                int cols)
+{
+  shared_ptr<const vector<Filter> > result;
+
+#pragma omp critical(FilterCache)
+  {
+    // Look for the size among the cached ones, most recently used first
+    list<pair<pair<int, int>, shared_ptr<const vector<Filter> > > >::iterator it = cache_.begin();
+
+    while ((it != cache_.end()) && (it->first != pair<int, int>(rows, cols)))
+      ++it;
+
+    if (it != cache_.end()) {
+      cache_.splice(cache_.begin(), cache_, it);
+      result = it->second;
+    }
+    else {
+      // Transform all the filters
+      shared_ptr<vector<Filter> > transformed(new vector<Filter>(filters.size()));
+
+#pragma omp parallel for
+      for (int i = 0; i < filters.size(); ++i)
+        TransformFilter(*filters[i], rows, cols, (*transformed)[i]);
+
+      cache_.push_front(make_pair(pair<int, int>(rows, cols), transformed));
 
-Patchwork::Patchwork() : padx_(0), pady_(0), interval_(0)
+      // Evict the least recently used sizes (their filters are released once no convolution uses
+      // them anymore)
+      while (cache_.size() > max(MaxCachedSizes(), 1))
+        cache_.pop_back();
+
+      result = transformed;
+    }
+  }
+
+  return result;
+}
+
+void Patchwork::FilterCache::clear()
+{
+#pragma omp critical(FilterCache)
+  cache_.clear();
+}
+
+Patchwork::Patchwork() : padx_(0), pady_(0), interval_(0), rows_(0), cols_(0), halfCols_(0),
+cost_(0.0)
 {
 }
 
@@ -70,6 +378,29 @@ private:
   const vector<pair<Rectangle, int> > & rectangles_;
 };
 
+// Order rectangles by decreasing height.
+class HeightComparator
+{
+public:
+  HeightComparator(const vector<pair<Rectangle, int> > & rectangles) :
+  rectangles_(rectangles)
+  {
+  }
+
+  // Returns whether rectangle a comes before b
+  bool operator()(int a, int b) const
+  {
+    const int heightA = rectangles_[a].first.height();
+    const int heightB = rectangles_[b].first.height();
+
+    return (heightA > heightB) || ((heightA == heightB) && (rectangles_[a].first.width() >
+                                rectangles_[b].first.width()));
+  }
+
+private:
+  const vector<pair<Rectangle, int> > & rectangles_;
+};
+
 // Order free gaps (rectangles) by position and then by size
 struct PositionComparator
 {
@@ -107,10 +438,13 @@ static int blf(vector<pair<Rectangle, int> > & rectangles, int maxWidth, int max
 
   vector<set<Rectangle, detail::PositionComparator> > gaps;
 
-  // Insert each rectangle in the first gap big enough
+  // Insert each rectangle in the first gap big enough (empty rectangles are not inserted)
   for (int i = 0; i < rectangles.size(); ++i) {
     pair<Rectangle, int> & rect = rectangles[ordering[i]];
 
+    if (rect.first.empty())
+      continue;
+
     // Find the first gap big enough
     set<Rectangle, detail::PositionComparator>::iterator g;
 
@@ -173,45 +507,283 @@ static int blf(vector<pair<Rectangle, int> > & rectangles, int maxWidth, int max
   return static_cast<int>(gaps.size());
 }
 
-Patchwork::Patchwork(const HOGPyramid & pyramid) : padx_(pyramid.padx()), pady_(pyramid.pady()),
-interval_(pyramid.interval())
+static int skyline(vector<pair<Rectangle, int> > & rectangles, int maxWidth, int maxHeight)
+{
+  // Order the rectangles by decreasing height. If a rectangle is bigger than MaxRows x MaxCols
+  // returns -1
+  vector<int> ordering(rectangles.size());
+
+  for (int i = 0; i < rectangles.size(); ++i) {
+    if ((rectangles[i].first.width() > maxWidth) || (rectangles[i].first.height() > maxHeight))
+      return -1;
+
+    ordering[i] = i;
+  }
+
+  sort(ordering.begin(), ordering.end(), detail::HeightComparator(rectangles));
+
+  // Index of the plane containing each rectangle
+  for (int i = 0; i < rectangles.size(); ++i)
+    rectangles[i].second = -1;
+
+  // Skyline of each plane: the bottom of the rectangles already packed, as a list of segments
+  // (x coordinate of their start, y coordinate of the first free row) ordered from left to right
+  vector<vector<pair<int, int> > > skylines;
+
+  // Insert each rectangle in the first plane where it fits, at the lowest (then leftmost) position
+  // along its skyline (empty rectangles are not inserted)
+  for (int i = 0; i < rectangles.size(); ++i) {
+    pair<Rectangle, int> & rect = rectangles[ordering[i]];
+
+    if (rect.first.empty())
+      continue;
+
+    const int width = rect.first.width();
+    const int height = rect.first.height();
+    int segment = -1;
+    int y = 0;
+
+    for (int p = 0; (rect.second == -1) && (p < skylines.size()); ++p) {
+      const vector<pair<int, int> > & s = skylines[p];
+
+      for (int j = 0; (j < s.size()) && (s[j].first + width <= maxWidth); ++j) {
+        // The rectangle rests on the highest segment it spans
+        int top = 0;
+
+        for (int k = j; (k < s.size()) && (s[k].first < s[j].first + width); ++k)
+          top = max(top, s[k].second);
+
+        if ((top + height <= maxHeight) && ((segment == -1) || (top < y))) {
+          segment = j;
+          y = top;
+        }
+      }
+
+      if (segment != -1)
+        rect.second = p;
+    }
+
+    // If it fits in no plane, add a new one
+    if (rect.second == -1) {
+      skylines.push_back(vector<pair<int, int> >(1, pair<int, int>(0, 0)));
+      rect.second = static_cast<int>(skylines.size()) - 1;
+      segment = 0;
+      y = 0;
+    }
+
+    // Insert the rectangle
+    vector<pair<int, int> > & s = skylines[rect.second];
+    const int left = s[segment].first;
+    const int right = left + width;
+
+    rect.first.setX(left);
+    rect.first.setY(y);
+
+    // Replace the segments it covers by its bottom, and what remains of the last one
+    int end = segment;
+    int last = 0;
+
+    while ((end < s.size()) && (s[end].first < right)) {
+      last = s[end].second;
+      ++end;
+    }
+
+    s.erase(s.begin() + segment, s.begin() + end);
+
+    if ((right < maxWidth) && ((segment == s.size()) || (s[segment].first > right)))
+      s.insert(s.begin() + segment, pair<int, int>(right, last));
+
+    s.insert(s.begin() + segment, pair<int, int>(left, y + height));
+  }
+
+  return static_cast<int>(skylines.size());
+}
+
+// Sum of the prime factors of n (with multiplicity) if n is a product of 2, 3, 5 and 7 (the sizes
+// most efficiently transformed by FFTW), or 0 otherwise
+static int SmoothFactors(int n)
+{
+  const int Primes[4] = {2, 3, 5, 7};
+  int sum = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    while (n % Primes[i] == 0) {
+      n /= Primes[i];
+      sum += Primes[i];
+    }
+  }
+
+  return (n == 1) ? sum : 0;
+}
+
+// Sizes between n and 2n which are powers of two or three times powers of two. Every octave holds
+// two of those sizes, efficiently transformed by FFTW, and the same ones are chosen for most images
+// so that few plans and transformed filters need to be cached
+static vector<int> PlaneSizes(int n)
+{
+  vector<int> sizes;
+
+  n = max(n, 2);
+
+  for (int i = 1; i <= n; i *= 2) {
+    if ((2 * i >= n) && (2 * i <= 2 * n))
+      sizes.push_back(2 * i);
+
+    if ((3 * i >= n) && (3 * i <= 2 * n))
+      sizes.push_back(3 * i);
+  }
+
+  return sizes;
+}
+
+int Patchwork::Layout(const HOGPyramid & pyramid, int nbFilters, Packing packing,
+                      const vector<bool> & levels, int & rows, int & cols,
+                      vector<pair<Rectangle, int> > & layout, double * cost)
 {
   // Remove the padding from the bottom/right sides since convolutions with Fourier wrap around
   const int nbLevels = static_cast<int>(pyramid.levels().size());
+  const int padx = pyramid.padx();
+  const int pady = pyramid.pady();
+
+  rows = 0;
+  cols = 0;
 
-  rectangles_.resize(nbLevels);
+  if (cost)
+    *cost = 0.0;
+
+  layout.assign(nbLevels, pair<Rectangle, int>());
+
+  int minRows = 0;
+  int minCols = 0;
+  int area = 0;
 
   for (int i = 0; i < nbLevels; ++i) {
-    rectangles_[i].first.setWidth(static_cast<int>(pyramid.levels()[i].cols()) - padx_);
-    rectangles_[i].first.setHeight(static_cast<int>(pyramid.levels()[i].rows()) - pady_);
+    // The levels not selected are treated as empty
+    if ((i < levels.size()) && !levels[i])
+      continue;
+
+    layout[i].first.setWidth(max(static_cast<int>(pyramid.levels()[i].cols()) - padx, 0));
+    layout[i].first.setHeight(max(static_cast<int>(pyramid.levels()[i].rows()) - pady, 0));
+    minRows = max(minRows, layout[i].first.height());
+    minCols = max(minCols, layout[i].first.width());
+    area += layout[i].first.area();
+  }
+
+  // Returns no plane in case of error
+  if (!area)
+    return 0;
+
+  // Try the sizes of planes between one and two times the size of the largest level among a fixed
+  // set of sizes efficiently transformed (see PlaneSizes()), and keep the one of least estimated
+  // cost (larger planes might need less of them to hold all the levels). The sizes are tried by
+  // increasing lower bound on their cost (that of a perfect packing) so that the search can stop
+  // as soon as none can be better
+  const vector<int> heights = PlaneSizes(minRows);
+  const vector<int> widths = PlaneSizes(minCols);
+  vector<pair<double, pair<int, int> > > sizes;
+
+  for (int i = 0; i < heights.size(); ++i) {
+    for (int j = 0; j < widths.size(); ++j) {
+      const int minPlanes = (area + heights[i] * widths[j] - 1) / (heights[i] * widths[j]);
+      sizes.push_back(make_pair(Cost(heights[i], widths[j], minPlanes, nbFilters),
+                    make_pair(heights[i], widths[j])));
+    }
+  }
+
+  sort(sizes.begin(), sizes.end());
+
+  vector<pair<Rectangle, int> > rectangles;
+  vector<pair<Rectangle, int> > other;
+  vector<pair<Rectangle, int> > best;
+  double bestCost = 0.0;
+  int nbPlanes = 0;
+
+  for (int i = 0; (i < sizes.size()) && (!nbPlanes || (sizes[i].first < bestCost)); ++i) {
+    const int height = sizes[i].second.first;
+    const int width = sizes[i].second.second;
+
+    rectangles = layout;
+
+    int n = (packing == SKYLINE) ? skyline(rectangles, width, height) :
+                                   blf(rectangles, width, height);
+
+    // Also try the skyline packing if the bottom-left fill did not reach the lower bound
+    if ((packing == MIN_PLANES) && (n != (area + height * width - 1) / (height * width))) {
+      other = layout;
+
+      const int m = skyline(other, width, height);
+
+      if ((m > 0) && ((n <= 0) || (m < n))) {
+        n = m;
+        rectangles.swap(other);
+      }
+    }
+
+    const double c = Cost(height, width, n, nbFilters);
+
+    if ((n > 0) && (!nbPlanes || (c < bestCost))) {
+      rows = height;
+      cols = width;
+      bestCost = c;
+      nbPlanes = n;
+      best.swap(rectangles);
+    }
   }
 
-  // Build the patchwork planes
-  const int nbPlanes = blf(rectangles_, MaxCols_, MaxRows_);
+  if (nbPlanes) {
+    layout.swap(best);
+
+    if (cost)
+      *cost = bestCost;
+  }
+
+  return nbPlanes;
+}
+
+Patchwork::Patchwork(const HOGPyramid & pyramid, int nbFilters, Packing packing,
+           const vector<bool> & levels) : padx_(pyramid.padx()),
+pady_(pyramid.pady()), interval_(pyramid.interval()), rows_(0), cols_(0), halfCols_(0),
+cost_(0.0)
+{
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+  const int nbPlanes = Layout(pyramid, nbFilters, packing, levels, rows_, cols_, rectangles_,
+                              &cost_);
+
+  if (nbPlanes)
+    plans_ = Plans(rows_, cols_, FFTW_MEASURE);
 
   // Constructs an empty patchwork in case of error
-  if (nbPlanes <= 0)
+  if (!plans_) {
+    rows_ = 0;
+    cols_ = 0;
+    cost_ = 0.0;
     return;
+  }
+
+  halfCols_ = cols_ / 2 + 1;
 
   planes_.resize(nbPlanes);
 
   for (int i = 0; i < nbPlanes; ++i) {
-    planes_[i] = Plane::Constant(MaxRows_, HalfCols_, Cell::Zero());
+    planes_[i] = Plane::Constant(rows_, halfCols_, Cell::Zero());
 
     Eigen::Map<HOGPyramid::Level, Eigen::Aligned>
-      plane(reinterpret_cast<HOGPyramid::Cell *>(planes_[i].data()), MaxRows_, 2 * HalfCols_);
+      plane(reinterpret_cast<HOGPyramid::Cell *>(planes_[i].data()), rows_, 2 * halfCols_);
 
     // Set the last feature to 1
-    for (int y = 0; y < MaxRows_; ++y)
-      for (int x = 0; x < MaxCols_; ++x)
+    for (int y = 0; y < rows_; ++y)
+      for (int x = 0; x < cols_; ++x)
         plane(y, x)(HOGPyramid::NbFeatures - 1) = 1;
   }
 
-  // Recopy the pyramid levels into the planes
+  // Recopy the pyramid levels into the planes (the empty levels are in none of them)
   for (int i = 0; i < nbLevels; ++i) {
+    if (rectangles_[i].second < 0)
+      continue;
+
     Eigen::Map<HOGPyramid::Level, Eigen::Aligned>
       plane(reinterpret_cast<HOGPyramid::Cell *>(planes_[rectangles_[i].second].data()),
-          MaxRows_, 2 * HalfCols_);
+          rows_, 2 * halfCols_);
 
     plane.block(rectangles_[i].first.y(), rectangles_[i].first.x(),
           rectangles_[i].first.height(), rectangles_[i].first.width()) =
@@ -219,16 +791,18 @@ interval_(pyramid.interval())
                         rectangles_[i].first.width());
   }
 
-  // Transform the planes
+  // Transform the planes and split the real and imaginary parts of their cells
 #pragma omp parallel for
-  for (int i = 0; i < nbPlanes; ++i)
+  for (int i = 0; i < nbPlanes; ++i) {
 #ifndef FFLD_HOGPYRAMID_DOUBLE
-    fftwf_execute_dft_r2c(Forwards_, reinterpret_cast<float *>(planes_[i].data()->data()),
+    fftwf_execute_dft_r2c(plans_->first, reinterpret_cast<float *>(planes_[i].data()->data()),
                 reinterpret_cast<fftwf_complex *>(planes_[i].data()->data()));
 #else
-    fftw_execute_dft_r2c(Forwards_, reinterpret_cast<double *>(planes_[i].data()->data()),
+    fftw_execute_dft_r2c(plans_->first, reinterpret_cast<double *>(planes_[i].data()->data()),
                reinterpret_cast<fftw_complex *>(planes_[i].data()->data()));
 #endif
+    detail::Split(planes_[i]);
+  }
 }
 
 bool Patchwork::empty() const
@@ -251,8 +825,33 @@ int Patchwork::interval() const
   return interval_;
 }
 
+int Patchwork::rows() const
+{
+  return rows_;
+}
+
+int Patchwork::cols() const
+{
+  return cols_;
+}
+
+int Patchwork::nbPlanes() const
+{
+  return static_cast<int>(planes_.size());
+}
+
+const vector<pair<Rectangle, int> > & Patchwork::layout() const
+{
+  return rectangles_;
+}
+
+double Patchwork::cost() const
+{
+  return cost_;
+}
+
 void Patchwork::convolve(const vector<Filter> & filters,
-             vector<vector<HOGPyramid::Matrix> > & convolutions) const
+             vector<vector<HOGPyramid::Matrix> > & convolutions, Workspace * workspace) const
 {
   const int nbFilters = static_cast<int>(filters.size());
   const int nbPlanes = static_cast<int>(planes_.size());
@@ -264,67 +863,94 @@ void Patchwork::convolve(const vector<Filter> & filters,
     return;
   }
 
+  // Only the filters transformed for planes of the same size can be convolved
+  vector<int> valid;
+
+  for (int j = 0; j < nbFilters; ++j)
+    if ((filters[j].first.rows() == rows_) && (filters[j].first.cols() == halfCols_))
+      valid.push_back(j);
+
+  const int nbValid = static_cast<int>(valid.size());
+
   // Pointwise multiply the transformed filters with the patchwork's planes
   // The performace measurements reported in the paper were done without reallocating the sums
-  // each time by making them static
-  // Even though it was faster (~10%) I removed it as it was not clean/thread safe
-  vector<vector<Patchwork::Matrix> > sums(nbPlanes);
+  // each time by making them static, which was faster (~10%) but not thread safe. A workspace
+  // (one per thread) gives the same speedup
+  vector<vector<Patchwork::Matrix> > tmpSums;
+  vector<vector<Patchwork::Matrix> > & sums = workspace ? workspace->sums_ : tmpSums;
+
+  if (sums.size() < nbPlanes)
+    sums.resize(nbPlanes);
 
   for (int i = 0; i < nbPlanes; ++i) {
     sums[i].resize(nbFilters);
 
-    for (int j = 0; j < nbFilters; ++j)
-      sums[i][j].resize(MaxRows_, HalfCols_);
+    for (int j = 0; j < nbValid; ++j)
+      sums[i][valid[j]].resize(rows_, halfCols_);
   }
 
-  // The following assumptions are not dangerous in the sense that the program will only work
-  // slower if they do not hold
-  const int cacheSize = 32768; // Assume L1 cache of 32K
+  // The fragments of all the planes (and of one filter) processed at once should fit in the L1
+  // cache. The following assumption is not dangerous in the sense that the program will only
+  // work slower if it does not hold
   const int fragmentsSize = (nbPlanes + 1) * sizeof(Cell); // Assume nbPlanes < nbFilters
-  const int step = min(cacheSize / fragmentsSize,
+  const int step = max(min(detail::L1CacheSize / fragmentsSize,
 #ifdef _OPENMP
-             MaxRows_ * HalfCols_ / omp_get_max_threads());
+               rows_ * halfCols_ / omp_get_max_threads()),
 #else
-             MaxRows_ * HalfCols_);
+               rows_ * halfCols_),
 #endif
+             1);
 
 #pragma omp parallel for
-  for (int i = 0; i <= MaxRows_ * HalfCols_ - step; i += step)
-    for (int j = 0; j < nbFilters; ++j)
+  for (int i = 0; i <= rows_ * halfCols_ - step; i += step)
+    for (int j = 0; j < nbValid; ++j)
       for (int k = 0; k < nbPlanes; ++k)
-        for (int l = 0; l < step; ++l)
-          sums[k][j](i + l) =
-            planes_[k](i + l).cwiseProduct(filters[j].first(i + l)).sum();
+        detail::MultiplyAccumulateDispatch(planes_[k].data() + i,
+                           filters[valid[j]].first.data() + i, step,
+                           sums[k][valid[j]].data() + i);
 
-  for (int i = MaxRows_ * HalfCols_ - ((MaxRows_ * HalfCols_) % step); i < MaxRows_ * HalfCols_;
-     ++i)
-    for (int j = 0; j < nbFilters; ++j)
-      for (int k = 0; k < nbPlanes; ++k)
-        sums[k][j](i) = planes_[k](i).cwiseProduct(filters[j].first(i)).sum();
+  const int last = rows_ * halfCols_ - ((rows_ * halfCols_) % step);
+
+  for (int j = 0; j < nbValid; ++j)
+    for (int k = 0; k < nbPlanes; ++k)
+      detail::MultiplyAccumulateDispatch(planes_[k].data() + last,
+                         filters[valid[j]].first.data() + last,
+                         rows_ * halfCols_ - last, sums[k][valid[j]].data() + last);
 
-  // Transform back the results and store them in convolutions
+  // Transform back the results and store them in convolutions, emptying those which will not be
+  // (the others keep their memory)
   convolutions.resize(nbFilters);
 
-  for (int i = 0; i < nbFilters; ++i)
+  vector<bool> isValid(nbFilters, false);
+
+  for (int j = 0; j < nbValid; ++j)
+    isValid[valid[j]] = true;
+
+  for (int i = 0; i < nbFilters; ++i) {
     convolutions[i].resize(nbLevels);
 
+    for (int j = 0; j < nbLevels; ++j)
+      if (!isValid[i] || (rectangles_[j].second < 0) ||
+        (rectangles_[j].first.height() + pady_ - filters[i].second.first < 0) ||
+        (rectangles_[j].first.width() + padx_ - filters[i].second.second < 0))
+        convolutions[i][j] = HOGPyramid::Matrix();
+  }
+
 #pragma omp parallel for
-  for (int i = 0; i < nbPlanes * nbFilters; ++i) {
+  for (int i = 0; i < nbPlanes * nbValid; ++i) {
     const int k = i % nbPlanes; // Plane index
-    const int l = i / nbPlanes; // Filter index
+    const int l = valid[i / nbPlanes]; // Filter index
 
     Eigen::Map<HOGPyramid::Matrix, Eigen::Aligned>
-      output(reinterpret_cast<HOGPyramid::Scalar *>(sums[k][l].data()), MaxRows_,
-           2 * HalfCols_);
+      output(reinterpret_cast<HOGPyramid::Scalar *>(sums[k][l].data()), rows_, 2 * halfCols_);
 
 #ifndef FFLD_HOGPYRAMID_DOUBLE
-    fftwf_execute_dft_c2r(Inverse_, reinterpret_cast<fftwf_complex *>(sums[k][l].data()),
+    fftwf_execute_dft_c2r(plans_->second, reinterpret_cast<fftwf_complex *>(sums[k][l].data()),
                 output.data());
 #else
-    fftw_execute_dft_c2r(Inverse_, reinterpret_cast<fftw_complex *>(sums[k][l].data()),
+    fftw_execute_dft_c2r(plans_->second, reinterpret_cast<fftw_complex *>(sums[k][l].data()),
                output.data());
 #endif
-
     for (int j = 0; j < nbLevels; ++j) {
       const int rows = rectangles_[j].first.height() + pady_ - filters[l].second.first + 1;
       const int cols = rectangles_[j].first.width() + padx_ - filters[l].second.second + 1;
@@ -354,131 +980,312 @@ void Patchwork::convolve(const vector<Filter> & filters,
   }
 }
 
-bool Patchwork::InitFFTW(int maxRows, int maxCols, bool cacheWisdom)
+double Patchwork::Cost(int rows, int cols, int nbPlanes, int nbFilters)
 {
-  // It is an error if maxRows or maxCols are too small
-  if ((maxRows < 2) || (maxCols < 2))
-    return false;
+  // A complex transform of size n = p1 x p2 x ... takes about 2.5 n (p1 + p2 + ...) operations
+  // (5 n log2(n) for powers of 2), and a real one half of it
+  const double transform = 1.25 * rows * cols * (SmoothFactors(rows) + SmoothFactors(cols));
 
-  // Temporary matrices
-  HOGPyramid::Matrix tmp(maxRows * HOGPyramid::NbFeatures, maxCols + 2);
+  // A complex multiply-add takes 8 operations
+  const double product = 8.0 * rows * (cols / 2 + 1) * HOGPyramid::NbFeatures;
 
-  int dims[2] = {maxRows, maxCols};
+  // Forward transforms of all the features of the planes, products with the filters, and inverse
+  // transforms of the sums
+  return nbPlanes * (HOGPyramid::NbFeatures * transform + nbFilters * (product + transform));
+}
 
-#ifndef FFLD_HOGPYRAMID_DOUBLE
-    if (cacheWisdom)
-    {
-        // Use fftwf_import_wisdom_from_file and not fftwf_import_wisdom_from_filename as old versions
-        // of fftw seem to not include it
-        FILE * file = fopen("wisdom.fftw", "r");
-
-        if (file) {
-            fftwf_import_wisdom_from_file(file);
-            fclose(file);
-        }
-    }
+double Patchwork::SpatialCost(int rows, int cols, int filterRows, int filterCols)
+{
+  // A multiply-add per feature of each cell of the filter at each position where it fits
+  if ((rows < filterRows) || (cols < filterCols))
+    return 0.0;
 
-  const fftwf_plan forwards =
-    fftwf_plan_many_dft_r2c(2, dims, HOGPyramid::NbFeatures, tmp.data(), 0,
-                HOGPyramid::NbFeatures, 1,
-                reinterpret_cast<fftwf_complex *>(tmp.data()), 0,
-                HOGPyramid::NbFeatures, 1, FFTW_PATIENT);
+  return 2.0 * (rows - filterRows + 1) * (cols - filterCols + 1) * filterRows * filterCols *
+       HOGPyramid::NbFeatures;
+}
 
-  const fftwf_plan inverse =
-    fftwf_plan_dft_c2r_2d(dims[0], dims[1], reinterpret_cast<fftwf_complex *>(tmp.data()),
-                tmp.data(), FFTW_PATIENT);
+double Patchwork::LevelCost(int rows, int cols, int nbFilters)
+{
+  if ((rows <= 0) || (cols <= 0))
+    return 0.0;
 
-    if (cacheWisdom)
-    {
-        FILE * file = fopen("wisdom.fftw", "w");
+  // The share of the level in the smallest planes able to hold it (the actual planes, sized for
+  // the largest level, are not known yet but the cost per cell only grows with their log)
+  const int planeRows = PlaneSizes(rows)[0];
+  const int planeCols = PlaneSizes(cols)[0];
 
-        if (file) {
-            fftwf_export_wisdom_to_file(file);
-            fclose(file);
-        }
-    }
-#else
-    if (cacheWisdom)
-    {
-        FILE * file = fopen("wisdom.fftw", "r");
+  return Cost(planeRows, planeCols, 1, nbFilters) * rows * cols / (planeRows * planeCols);
+}
 
-        if (file) {
-            fftw_import_wisdom_from_file(file);
-            fclose(file);
-        }
-    }
+void Patchwork::SelectLevels(const HOGPyramid & pyramid,
+                 const vector<pair<int, int> > & filterSizes, vector<bool> & levels)
+{
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+  const int nbFilters = static_cast<int>(filterSizes.size());
 
-  const fftw_plan forwards =
-    fftw_plan_many_dft_r2c(2, dims, HOGPyramid::NbFeatures, tmp.data(), 0,
-                 HOGPyramid::NbFeatures, 1,
-                 reinterpret_cast<fftw_complex *>(tmp.data()), 0,
-                 HOGPyramid::NbFeatures, 1, FFTW_PATIENT);
+  // Read the ratio once so that all the levels are selected with the same one
+  const double ratio = detail::SpatialRatio;
 
-  const fftw_plan inverse =
-    fftw_plan_dft_c2r_2d(dims[0], dims[1], reinterpret_cast<fftw_complex *>(tmp.data()),
-               tmp.data(), FFTW_PATIENT);
+  levels.resize(nbLevels);
 
-    if (cacheWisdom)
-    {
-        FILE * file = fopen("wisdom.fftw", "w");
+  for (int i = 0; i < nbLevels; ++i) {
+    const int rows = static_cast<int>(pyramid.levels()[i].rows());
+    const int cols = static_cast<int>(pyramid.levels()[i].cols());
 
-        if (file) {
-            fftw_export_wisdom_to_file(file);
-            fclose(file);
-        }
-    }
-#endif
+    const double fourier = LevelCost(rows - pyramid.pady(), cols - pyramid.padx(), nbFilters);
+
+    double spatial = 0.0;
+
+    for (int j = 0; j < nbFilters; ++j)
+      spatial += SpatialCost(rows, cols, filterSizes[j].first, filterSizes[j].second);
+
+    // The empty levels are not selected
+    levels[i] = (fourier > 0.0) && (spatial * ratio >= fourier);
+  }
+}
+
+void Patchwork::Convolve(const HOGPyramid & pyramid,
+             const vector<const HOGPyramid::Level *> & filters, FilterCache & cache,
+             vector<vector<HOGPyramid::Matrix> > & convolutions, Workspace * workspace)
+{
+  const int nbFilters = static_cast<int>(filters.size());
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+
+  vector<pair<int, int> > sizes(nbFilters);
+
+  for (int i = 0; i < nbFilters; ++i)
+    sizes[i] = pair<int, int>(filters[i]->rows(), filters[i]->cols());
+
+  // Select the levels whose convolutions are faster with a patchwork than in the spatial domain
+  vector<bool> levels;
+
+  SelectLevels(pyramid, sizes, levels);
+
+  convolutions.assign(nbFilters, vector<HOGPyramid::Matrix>());
+
+  if (find(levels.begin(), levels.end(), true) != levels.end()) {
+    // Create a patchwork of those levels with planes of the least convolution cost
+    const Patchwork patchwork(pyramid, nbFilters, MIN_PLANES, levels);
 
-  // If successful, set MaxRows_, MaxCols_, HalfCols_, Forwards_ and Inverse_
-  if (forwards && inverse) {
-    MaxRows_ = maxRows;
-    MaxCols_ = maxCols;
-    HalfCols_ = maxCols / 2 + 1;
-    Forwards_ = forwards;
-    Inverse_ = inverse;
-    return true;
+    // Transform the filters for the size of its planes if needed
+    const shared_ptr<const vector<Filter> > transformed =
+      cache.filters(filters, patchwork.rows(), patchwork.cols());
+
+    // Convolve the patchwork with the filters
+    patchwork.convolve(*transformed, convolutions, workspace);
+
+    // In case of error
+    if (convolutions.empty())
+      return;
+  }
+
+  // Convolve the other levels in the spatial domain
+  for (int i = 0; i < nbFilters; ++i)
+    convolutions[i].resize(nbLevels);
+
+#pragma omp parallel for
+  for (int i = 0; i < nbLevels; ++i) {
+    if (!levels[i]) {
+      vector<HOGPyramid::Matrix> tmp;
+
+      pyramid.convolve(filters, i, tmp);
+
+      for (int j = 0; j < nbFilters; ++j)
+        convolutions[j][i].swap(tmp[j]);
+    }
   }
+}
+
+double Patchwork::SpatialRatio()
+{
+  return detail::SpatialRatio;
+}
+
+void Patchwork::SetSpatialRatio(double ratio)
+{
+  if (ratio > 0.0)
+    detail::SpatialRatio = ratio;
+}
+
+bool Patchwork::LoadCalibration(const string & filename)
+{
+  FILE * file = fopen(filename.c_str(), "r");
+
+  if (!file)
+    return false;
+
+  double ratio = 0.0;
+  const bool success = (fscanf(file, "%lf", &ratio) == 1) && (ratio > 0.0);
+
+  fclose(file);
+
+  if (success)
+    detail::SpatialRatio = ratio;
+
+  return success;
+}
+
+bool Patchwork::SaveCalibration(const string & filename)
+{
+  FILE * file = fopen(filename.c_str(), "w");
+
+  if (!file)
+    return false;
+
+  const bool success = fprintf(file, "%.6g\n", detail::SpatialRatio.load()) > 0;
+
+  return (fclose(file) == 0) && success;
+}
 
-  return false;
+int Patchwork::MaxCachedSizes()
+{
+  return detail::MaxCachedSizes;
 }
 
-int Patchwork::MaxRows()
+void Patchwork::SetMaxCachedSizes(int maxSizes)
 {
-  return MaxRows_;
+  if (maxSizes > 0)
+    detail::MaxCachedSizes = maxSizes;
 }
 
-int Patchwork::MaxCols()
+bool Patchwork::InitFFTW(int maxRows, int maxCols, bool cacheWisdom)
 {
-  return MaxCols_;
+  // It is an error if maxRows or maxCols are too small
+  if ((maxRows < 2) || (maxCols < 2))
+    return false;
+
+  detail::CacheWisdom = cacheWisdom;
+
+  return static_cast<bool>(Plans(maxRows, maxCols, FFTW_PATIENT));
 }
 
-void Patchwork::TransformFilter(const HOGPyramid::Level & filter, Filter & result)
+void Patchwork::TransformFilter(const HOGPyramid::Level & filter, int rows, int cols,
+                Filter & result)
 {
-  // Early return if no filter given or if Init was not called or if the filter is too large
-  if (!filter.size() || !MaxRows_ || (filter.rows() > MaxRows_) || (filter.cols() > MaxCols_)) {
+  // Early return if no filter given or if the filter is too large
+  if (!filter.size() || (filter.rows() > rows) || (filter.cols() > cols)) {
+    result = Filter();
+    return;
+  }
+
+  const shared_ptr<const PlanPair> plans = Plans(rows, cols, FFTW_MEASURE);
+
+  if (!plans) {
     result = Filter();
     return;
   }
 
+  const int halfCols = cols / 2 + 1;
+
   // Recopy the filter into a plane
-  result.first = Plane::Constant(MaxRows_, HalfCols_, Cell::Zero());
+  result.first = Plane::Constant(rows, halfCols, Cell::Zero());
   result.second = pair<int, int>(static_cast<int>(filter.rows()),
                    static_cast<int>(filter.cols()));
 
   Eigen::Map<HOGPyramid::Level, Eigen::Aligned>
-    plane(reinterpret_cast<HOGPyramid::Cell *>(result.first.data()), MaxRows_, 2 * HalfCols_);
+    plane(reinterpret_cast<HOGPyramid::Cell *>(result.first.data()), rows, 2 * halfCols);
 
   for (int y = 0; y < filter.rows(); ++y)
     for (int x = 0; x < filter.cols(); ++x)
-      plane((MaxRows_ - y) % MaxRows_, (MaxCols_ - x) % MaxCols_) = filter(y, x) /
-                                      (MaxRows_ * MaxCols_);
+      plane((rows - y) % rows, (cols - x) % cols) = filter(y, x) / (rows * cols);
 
-  // Transform that plane
+  // Transform that plane and split the real and imaginary parts of its cells
 #ifndef FFLD_HOGPYRAMID_DOUBLE
-  fftwf_execute_dft_r2c(Forwards_, reinterpret_cast<float *>(plane.data()->data()),
+  fftwf_execute_dft_r2c(plans->first, reinterpret_cast<float *>(plane.data()->data()),
               reinterpret_cast<fftwf_complex *>(result.first.data()->data()));
 #else
-  fftw_execute_dft_r2c(Forwards_, reinterpret_cast<double *>(plane.data()->data()),
+  fftw_execute_dft_r2c(plans->first, reinterpret_cast<double *>(plane.data()->data()),
              reinterpret_cast<fftw_complex *>(result.first.data()->data()));
 #endif
+  detail::Split(result.first);
+}
+
+shared_ptr<const Patchwork::PlanPair> Patchwork::Plans(int rows, int cols, unsigned flags)
+{
+  shared_ptr<const PlanPair> plans = detail::CachedPlans(rows, cols);
+
+  if (plans)
+    return plans;
+
+  // The plans evicted from the cache, destroyed (if no patchwork uses them anymore) once the
+  // mutexes are released
+  vector<shared_ptr<const PlanPair> > evicted;
+
+  // Only one thread creates plans at a time, but the others can still use the cached ones
+  lock_guard<mutex> lock(detail::FFTWPlannerMutex);
+
+  // Another thread might have created them while this one was waiting
+  plans = detail::CachedPlans(rows, cols);
+
+  if (plans)
+    return plans;
+
+  // Plan with the wisdom of the previous runs
+  if (detail::CacheWisdom && !detail::WisdomLoaded) {
+    detail::LoadWisdom();
+    detail::WisdomLoaded = true;
+  }
+
+  // Temporary matrices
+  HOGPyramid::Matrix tmp(rows * HOGPyramid::NbFeatures, cols + 2);
+
+  int dims[2] = {rows, cols};
+
+  Plan forwards;
+  Plan inverse;
+
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+  forwards = fftwf_plan_many_dft_r2c(2, dims, HOGPyramid::NbFeatures, tmp.data(), 0,
+                     HOGPyramid::NbFeatures, 1,
+                     reinterpret_cast<fftwf_complex *>(tmp.data()), 0,
+                     HOGPyramid::NbFeatures, 1, flags);
+
+  inverse = fftwf_plan_dft_c2r_2d(dims[0], dims[1],
+                  reinterpret_cast<fftwf_complex *>(tmp.data()), tmp.data(), flags);
+#else
+  forwards = fftw_plan_many_dft_r2c(2, dims, HOGPyramid::NbFeatures, tmp.data(), 0,
+                    HOGPyramid::NbFeatures, 1,
+                    reinterpret_cast<fftw_complex *>(tmp.data()), 0,
+                    HOGPyramid::NbFeatures, 1, flags);
+
+  inverse = fftw_plan_dft_c2r_2d(dims[0], dims[1], reinterpret_cast<fftw_complex *>(tmp.data()),
+                 tmp.data(), flags);
+#endif
+
+  // In case of error
+  if (!forwards || !inverse) {
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+    if (forwards)
+      fftwf_destroy_plan(forwards);
+
+    if (inverse)
+      fftwf_destroy_plan(inverse);
+#else
+    if (forwards)
+      fftw_destroy_plan(forwards);
+
+    if (inverse)
+      fftw_destroy_plan(inverse);
+#endif
+    return shared_ptr<const PlanPair>();
+  }
+
+  plans.reset(new PlanPair(forwards, inverse), detail::DestroyPlans);
+
+  // Save the wisdom gained by planning this size for the next runs
+  if (detail::CacheWisdom)
+    detail::SaveWisdom();
+
+  // Insert them before releasing the planner so that no other thread creates them again
+  lock_guard<mutex> cacheLock(detail::FFTWPlanMutex);
+
+  detail::FFTWPlanCache.push_front(make_pair(pair<int, int>(rows, cols), plans));
+
+  // Evict the least recently used sizes
+  while (detail::FFTWPlanCache.size() > max(MaxCachedSizes(), 1)) {
+    evicted.push_back(detail::FFTWPlanCache.back().second);
+    detail::FFTWPlanCache.pop_back();
+  }
+
+  return plans;
 }
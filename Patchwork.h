@@ -25,7 +25,11 @@
 #include "HOGPyramid.h"
 #include "Rectangle.h"
 
+#include <list>
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <fftw3.h>
 
@@ -45,21 +49,102 @@ public:
   typedef Eigen::Array<Scalar, HOGPyramid::NbFeatures, 1> Cell;
 
   /// Type of a patchwork plane (matrix of cells).
+  /// @note The cells of the transformed planes and filters are stored split: the real parts of
+  /// all the features followed by their imaginary parts (the layout of the products with the
+  /// filters, which then need no shuffling), rather than as complex numbers.
   typedef Eigen::Matrix<Cell, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Plane;
 
   /// Type of a patchwork filter (plane + original filter size).
   typedef std::pair<Plane, std::pair<int, int> > Filter;
 
+  /// Algorithms packing the pyramid levels into the planes.
+  enum Packing
+  {
+    BOTTOM_LEFT_FILL, ///< Largest levels first, each in the first free gap big enough.
+    SKYLINE, ///< Tallest levels first, each at the lowest position along the skyline of a plane.
+    MIN_PLANES ///< Bottom-left fill, or skyline if it needs fewer planes.
+  };
+
+  /// The Workspace class keeps the memory used by the convolutions of patchworks (the products of
+  /// the planes with the filters in the frequency domain) so that it can be reused from one call to
+  /// the next.
+  /// @note The memory is reused as long as the size and the number of the planes and the number
+  /// of filters do not change. It is never released before the destruction of the workspace.
+  /// @note A workspace must not be used by several convolutions concurrently (use one per thread).
+  class Workspace
+  {
+  public:
+    /// Constructs an empty workspace.
+    Workspace();
+
+  private:
+    std::vector<std::vector<Matrix> > sums_;
+
+    friend class Patchwork;
+  };
+
+  /// The FilterCache class keeps a list of filters (e.g. those of a Mixture) transformed for the
+  /// most recently used sizes of planes, most recent first (see MaxCachedSizes()).
+  /// @note Thread safe. Copies share the transformed filters already cached.
+  class FilterCache
+  {
+  public:
+    /// Constructs an empty cache.
+    FilterCache();
+
+    /// Returns the transformed @p filters for planes of @p rows x @p cols, transforming them if
+    /// they are not already cached.
+    /// @note The filters must be the same at each call, the cache has to be cleared when they
+    /// change.
+    std::shared_ptr<const std::vector<Filter> >
+    filters(const std::vector<const HOGPyramid::Level *> & filters, int rows, int cols);
+
+    /// Empties the cache (the filters are released once no convolution uses them anymore).
+    void clear();
+
+  private:
+    std::list<std::pair<std::pair<int, int>, std::shared_ptr<const std::vector<Filter> > > >
+      cache_;
+  };
+
   /// Constructs an empty patchwork. An empty patchwork has no plane.
   Patchwork();
 
   /// Constructs a patchwork from a pyramid.
   /// @param[in] pyramid Pyramid.
-  /// @note If the pyramid is larger than the last maxRows and maxCols passed to the Init method
-  /// the Patchwork will be empty.
+  /// @param[in] nbFilters Number of filters the patchwork will be convolved with.
+  /// @param[in] packing Algorithm packing the levels into the planes.
+  /// @param[in] levels Levels to store (all if empty, see SelectLevels()).
+  /// @note The size of the planes is chosen among the powers of two and three times the powers of
+  /// two (a small fixed set of sizes efficiently transformed by FFTW) between one and two times
+  /// the size of the largest stored level (without the padding on the bottom/right sides), so as
+  /// to minimize the estimated cost of the convolutions with @p nbFilters filters (see cost()).
+  /// @note The FFTW plans of each size are created the first time they are needed and cached (see
+  /// MaxCachedSizes()). Only one size is planned at a time, but the cached plans remain available
+  /// to the other threads meanwhile.
   /// @note Assumes that the features of the pyramid levels are zero in the padded regions but for
   /// the last feature, which is assumed to be one.
-  explicit Patchwork(const HOGPyramid & pyramid);
+  /// @note Empty pyramid levels and the levels not selected are not stored and give empty
+  /// convolutions.
+  explicit Patchwork(const HOGPyramid & pyramid, int nbFilters = 1,
+             Packing packing = MIN_PLANES,
+             const std::vector<bool> & levels = std::vector<bool>());
+
+  /// Chooses the size of the planes and the layout of the pyramid levels as the constructor would,
+  /// without copying nor transforming the levels (useful to know the size of the planes in
+  /// advance, e.g. to cache the transformed filters).
+  /// @param[in] pyramid Pyramid.
+  /// @param[in] nbFilters Number of filters the patchwork will be convolved with.
+  /// @param[in] packing Algorithm packing the levels into the planes.
+  /// @param[in] levels Levels to store (all if empty, see SelectLevels()).
+  /// @param[out] rows Number of rows of the planes (zero in case of error).
+  /// @param[out] cols Number of columns of the planes (zero in case of error).
+  /// @param[out] layout Layout of the pyramid levels in the planes (see layout()).
+  /// @param[out] cost Estimated cost of the convolutions (see cost()).
+  /// @returns The number of planes (zero in case of error).
+  static int Layout(const HOGPyramid & pyramid, int nbFilters, Packing packing,
+            const std::vector<bool> & levels, int & rows, int & cols,
+            std::vector<std::pair<Rectangle, int> > & layout, double * cost = 0);
 
   /// Returns whether the patchwork is empty. An empty patchwork has no plane.
   bool empty() const;
@@ -73,50 +158,155 @@ public:
   /// Returns the number of levels per octave in the pyramid.
   int interval() const;
 
+  /// Returns the number of rows of the planes.
+  int rows() const;
+
+  /// Returns the number of columns of the planes.
+  int cols() const;
+
+  /// Returns the number of planes.
+  int nbPlanes() const;
+
+  /// Returns the layout of the pyramid levels in the planes: the rectangle occupied by each level
+  /// (without the padding on the bottom/right sides) and the index of its plane (-1 if the level
+  /// is empty).
+  const std::vector<std::pair<Rectangle, int> > & layout() const;
+
+  /// Returns the estimated cost of the convolutions (in floating point operations): forward
+  /// transforms of the planes, products with the filters in the frequency domain, and inverse
+  /// transforms of the results.
+  double cost() const;
+
   /// Returns the convolutions of the patchwork with filters (useful to compute the SVM margins).
-  /// @param[in] filters Filters.
+  /// @param[in] filters Filters (transformed for planes of the size of the patchwork).
   /// @param[out] convolutions Convolution of each filter and each level.
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// convolutions.
+  /// @note The convolutions of the filters transformed for planes of another size (or too large
+  /// to be transformed) are empty.
+  /// @note The matrices of @p convolutions are reused if they already have the right size.
   void convolve(const std::vector<Filter> & filters,
-          std::vector<std::vector<HOGPyramid::Matrix> > & convolutions) const;
+          std::vector<std::vector<HOGPyramid::Matrix> > & convolutions,
+          Workspace * workspace = 0) const;
 
-  /// Initializes the FFTW library.
-  /// @param[in] maxRows Maximum number of rows of a pyramid level (including padding).
-  /// @param[in] maxCols Maximum number of columns of a pyramid level (including padding).
+  /// Initializes the FFTW library and creates the plans for planes of a given size in advance.
+  /// @param[in] maxRows Number of rows of the planes.
+  /// @param[in] maxCols Number of columns of the planes.
+  /// @param[in] cacheWisdom Whether to load and save the FFTW wisdom from and to a file.
   /// @returns Whether the initialization was successful.
-  /// @note Must be called before any other method (including constructors).
-    static bool InitFFTW(int maxRows, int maxCols, bool cacheWisdom = true);
+  /// @note Optional, the plans of each size are otherwise created when first needed (with a
+  /// faster but less thorough planning).
+  /// @note Unless disabled here, the wisdom is loaded from the file wisdom.fftw of the current
+  /// directory before the first plans are created, and saved to it after each new size of planes
+  /// is planned, so that the planning is only slow the first time a size is used.
+  static bool InitFFTW(int maxRows, int maxCols, bool cacheWisdom = true);
 
-  /// Returns the current maximum number of rows of a pyramid level (including padding).
-  static int MaxRows();
+  /// Returns the maximum number of sizes of planes for which the FFTW plans (a few tens of
+  /// kilobytes per size) and the transformed filters of each Mixture and MixtureSet are cached.
+  /// A transformed filter takes <tt>rows x (cols / 2 + 1) x NbFeatures</tt> complex numbers, about
+  /// 0.5 MB for planes of 64x64 cells, hence about 30 MB per size for a mixture of 54 filters. The
+  /// least recently used size is evicted first.
+  /// @note Four unless set by SetMaxCachedSizes().
+  static int MaxCachedSizes();
 
-  /// Returns the current maximum number of columns of a pyramid level (including padding).
-  static int MaxCols();
+  /// Sets the maximum number of sizes of planes for which the FFTW plans and the transformed
+  /// filters are cached (see MaxCachedSizes()).
+  /// @note The entries already cached are only evicted when a new size is cached.
+  static void SetMaxCachedSizes(int maxSizes);
 
   /// Returns a transformed version of a filter to be used by the @c convolve method.
   /// @param[in] filter Filter to transform.
+  /// @param[in] rows Number of rows of the planes of the patchwork.
+  /// @param[in] cols Number of columns of the planes of the patchwork.
   /// @param[out] result Transformed filter.
-  /// @note If Init was not already called or if the filter is larger than the last maxRows and
-  /// maxCols passed to the Init method the result will be empty.
-  static void TransformFilter(const HOGPyramid::Level & filter, Filter & result);
+  /// @note If the filter is larger than the planes the result will be empty.
+  static void TransformFilter(const HOGPyramid::Level & filter, int rows, int cols,
+                Filter & result);
+
+  /// Returns the estimated cost (in floating point operations) of the convolution of a pyramid
+  /// level of @p rows x @p cols cells with a filter of @p filterRows x @p filterCols cells in the
+  /// spatial domain (see HOGPyramid::convolve).
+  static double SpatialCost(int rows, int cols, int filterRows, int filterCols);
+
+  /// Returns the estimated share of a pyramid level of @p rows x @p cols cells (without the
+  /// padding on the bottom/right sides) in the cost of the convolutions of a patchwork with
+  /// @p nbFilters filters (see cost()).
+  static double LevelCost(int rows, int cols, int nbFilters);
+
+  /// Selects the pyramid levels whose convolutions with a group of filters are cheaper with a
+  /// patchwork than in the spatial domain, according to the estimated costs of both and to the
+  /// calibrated ratio of their speeds (see SpatialRatio()).
+  /// @param[in] pyramid Pyramid.
+  /// @param[in] filterSizes Size of each filter of the group (<tt>rows x cols</tt>).
+  /// @param[out] levels Whether each level should be stored in the patchwork (to be passed to
+  /// the constructor), the others being convolved in the spatial domain. Empty levels are not
+  /// selected.
+  static void SelectLevels(const HOGPyramid & pyramid,
+               const std::vector<std::pair<int, int> > & filterSizes,
+               std::vector<bool> & levels);
+
+  /// Returns the convolutions of a pyramid with filters, the levels selected by SelectLevels()
+  /// being convolved with a patchwork and the others in the spatial domain.
+  /// @param[in] pyramid Pyramid.
+  /// @param[in] filters Filters (not copied).
+  /// @param[in] cache Cache of the transformed @p filters.
+  /// @param[out] convolutions Convolution of each filter and each level (empty in case of error).
+  /// @param[in] workspace Optional workspace from which to reuse the memory of previous
+  /// convolutions.
+  static void Convolve(const HOGPyramid & pyramid,
+             const std::vector<const HOGPyramid::Level *> & filters, FilterCache & cache,
+             std::vector<std::vector<HOGPyramid::Matrix> > & convolutions,
+             Workspace * workspace = 0);
+
+  /// Returns the ratio of the time taken by a floating point operation of the spatial
+  /// convolutions (see SpatialCost()) to that of one of the patchwork convolutions (see cost()).
+  /// @note One unless set by SetSpatialRatio() or LoadCalibration().
+  static double SpatialRatio();
+
+  /// Sets the ratio of the time taken by a floating point operation of the spatial convolutions
+  /// to that of one of the patchwork convolutions (see SpatialRatio()).
+  /// @note Thread safe, the ratio can be changed while other threads are detecting.
+  static void SetSpatialRatio(double ratio);
+
+  /// Reads the ratio of the speeds of the spatial and patchwork convolutions from a file written
+  /// by SaveCalibration() (see the calibrate executable).
+  /// @returns Whether the file could be read.
+  /// @note Thread safe, the ratio can be reloaded while other threads are detecting.
+  static bool LoadCalibration(const std::string & filename = "calibration.txt");
+
+  /// Writes the ratio of the speeds of the spatial and patchwork convolutions to a file.
+  /// @returns Whether the file could be written.
+  static bool SaveCalibration(const std::string & filename = "calibration.txt");
 
 private:
+#ifndef FFLD_HOGPYRAMID_DOUBLE
+  typedef fftwf_plan Plan;
+#else
+  typedef fftw_plan Plan;
+#endif
+
+  // Forward and inverse plans of a size of planes (destroyed with the last patchwork using them
+  // once evicted from the cache)
+  typedef std::pair<Plan, Plan> PlanPair;
+
+  // Returns the estimated cost of the convolutions of nbPlanes planes of rows x cols with
+  // nbFilters filters
+  static double Cost(int rows, int cols, int nbPlanes, int nbFilters);
+
+  // Returns the forward and inverse plans of planes of rows x cols, creating them if needed
+  // (thread safe, see InitFFTW for the wisdom). Returns null if they could not be created
+  static std::shared_ptr<const PlanPair> Plans(int rows, int cols, unsigned flags);
+
   int padx_;
   int pady_;
   int interval_;
+  int rows_;
+  int cols_;
+  int halfCols_;
+  double cost_;
+  std::shared_ptr<const PlanPair> plans_;
   std::vector<std::pair<Rectangle, int> > rectangles_;
   std::vector<Plane> planes_;
-
-  static int MaxRows_;
-  static int MaxCols_;
-  static int HalfCols_;
-
-#ifndef FFLD_HOGPYRAMID_DOUBLE
-  static fftwf_plan Forwards_;
-  static fftwf_plan Inverse_;
-#else
-  static fftw_plan Forwards_;
-  static fftw_plan Inverse_;
-#endif
 };
 }
 
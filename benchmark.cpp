@@ -0,0 +1,323 @@
+//--------------------------------------------------------------------------------------------------
+// Implementation of the papers "Exact Acceleration of Linear Object Detectors", 12th European
+// Conference on Computer Vision, 2012 and "Deformable Part Models with Individual Part Scaling",
+// 24th British Machine Vision Conference, 2013.
+//
+// Copyright (c) 2013 Idiap Research Institute, <http://www.idiap.ch/>
+// Written by Charles Dubout <charles.dubout@idiap.ch>
+//
+// This file is part of FFLDv2 (the Fast Fourier Linear Detector version 2)
+//
+// FFLDv2 is free software: you can redistribute it and/or modify it under the terms of the GNU
+// Affero General Public License version 3 as published by the Free Software Foundation.
+//
+// FFLDv2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+// the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero
+// General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License along with FFLDv2. If
+// not, see <http://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------------------------------------
+
+#include "SimpleOpt.h"
+
+#include "Mixture.h"
+#include "Scene.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#ifndef _WIN32
+#include <sys/time.h>
+
+inline double milliseconds()
+{
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+#else
+#include <time.h>
+#include <windows.h>
+
+inline double milliseconds()
+{
+  ULARGE_INTEGER now;
+  GetSystemTimeAsFileTime((FILETIME *)&now);
+  return now.QuadPart / 10000.0;
+}
+#endif
+
+using namespace FFLD;
+using namespace std;
+
+// SimpleOpt array of valid options
+enum
+{
+  OPT_INTERVAL, OPT_HELP, OPT_MODEL, OPT_PADDING, OPT_NB_IMAGES, OPT_APPROXIMATE
+};
+
+CSimpleOpt::SOption SOptions[] =
+{
+  { OPT_INTERVAL, "-e", SO_REQ_SEP },
+  { OPT_INTERVAL, "--interval", SO_REQ_SEP },
+  { OPT_HELP, "-h", SO_NONE },
+  { OPT_HELP, "--help", SO_NONE },
+  { OPT_MODEL, "-m", SO_REQ_SEP },
+  { OPT_MODEL, "--model", SO_REQ_SEP },
+  { OPT_PADDING, "-p", SO_REQ_SEP },
+  { OPT_PADDING, "--padding", SO_REQ_SEP },
+  { OPT_NB_IMAGES, "-z", SO_REQ_SEP },
+  { OPT_NB_IMAGES, "--nb-images", SO_REQ_SEP },
+  { OPT_APPROXIMATE, "-a", SO_NONE },
+  { OPT_APPROXIMATE, "--approximate", SO_NONE },
+  SO_END_OF_OPTIONS
+};
+
+void showUsage()
+{
+  cout << "Usage: benchmark [options] image.jpg, or\n       benchmark [options] image_set.txt\n\n"
+      "Compares the number of patchwork planes and the convolution time of each packing\n"
+      "algorithm on the pyramids of an image or of all the images of a dataset.\n\n"
+      "Options:\n"
+      "  -a,--approximate         Approximate the HOG pyramid levels within each octave\n"
+      "  -e,--interval <arg>      Number of levels per octave in the HOG pyramid (default 5)"
+      "\n"
+      "  -h,--help                Display this information\n"
+      "  -m,--model <file>        Read the input model from <file> (default \"model.txt\")\n"
+      "  -p,--padding <arg>       Amount of zero padding in HOG cells (default 6)\n"
+      "  -z,--nb-images <arg>     Maximum number of images to consider (default all)"
+     << endl;
+}
+
+int main(int argc, char ** argv)
+{
+  // Default parameters
+  int interval = 5;
+  string model("model.txt");
+  int padding = 6;
+  int nbImages = -1;
+  bool approximate = false;
+
+  // Parse the parameters
+  CSimpleOpt args(argc, argv, SOptions);
+
+  while (args.Next()) {
+    if (args.LastError() == SO_SUCCESS) {
+      if (args.OptionId() == OPT_INTERVAL) {
+        interval = atoi(args.OptionArg());
+
+        // Error checking
+        if (interval <= 0) {
+          showUsage();
+          cerr << "\nInvalid interval arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_HELP) {
+        showUsage();
+        return 0;
+      }
+      else if (args.OptionId() == OPT_MODEL) {
+        model = args.OptionArg();
+      }
+      else if (args.OptionId() == OPT_PADDING) {
+        padding = atoi(args.OptionArg());
+
+        if (padding <= 1) {
+          showUsage();
+          cerr << "\nInvalid padding arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_NB_IMAGES) {
+        nbImages = atoi(args.OptionArg());
+
+        if (nbImages <= 0) {
+          showUsage();
+          cerr << "\nInvalid nb-images arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_APPROXIMATE) {
+        approximate = true;
+      }
+    }
+    else {
+      showUsage();
+      cerr << "\nUnknown option " << args.OptionText() << endl;
+      return -1;
+    }
+  }
+
+  if (!args.FileCount()) {
+    showUsage();
+    cerr << "\nNo image/dataset provided" << endl;
+    return -1;
+  }
+  else if (args.FileCount() > 1) {
+    showUsage();
+    cerr << "\nMore than one image/dataset provided" << endl;
+    return -1;
+  }
+
+  // Try to open the mixture
+  ifstream in(model.c_str(), ios::binary);
+
+  if (!in.is_open()) {
+    showUsage();
+    cerr << "\nInvalid model file " << model << endl;
+    return -1;
+  }
+
+  Mixture mixture;
+  in >> mixture;
+
+  if (mixture.empty()) {
+    showUsage();
+    cerr << "\nInvalid model file " << model << endl;
+    return -1;
+  }
+
+  // The image/dataset
+  const string file(args.File(0));
+  const size_t lastDot = file.find_last_of('.');
+
+  if ((lastDot == string::npos) ||
+    ((file.substr(lastDot) != ".jpg") && (file.substr(lastDot) != ".txt"))) {
+    showUsage();
+    cerr << "\nInvalid file " << file << ", should be .jpg or .txt" << endl;
+    return -1;
+  }
+
+  // List the images
+  vector<string> files;
+
+  if (file.substr(lastDot) == ".jpg") {
+    files.push_back(file);
+  }
+  else {
+    in.close();
+    in.open(file.c_str(), ios::binary);
+
+    if (!in.is_open()) {
+      showUsage();
+      cerr << "\nInvalid image_set file " << file << endl;
+      return -1;
+    }
+
+    // Find the annotations' folder (not sure that will work under Windows)
+    const string folder = file.substr(0, file.find_last_of("/\\")) + "/../../Annotations/";
+
+    while (in && ((nbImages < 0) || (files.size() < nbImages))) {
+      string line;
+      getline(in, line);
+
+      // Skip empty lines
+      if (line.empty() || (line.size() < 3))
+        continue;
+
+      const Scene scene(folder + line.substr(0, line.find(' ')) + ".xml");
+
+      if (!scene.empty())
+        files.push_back(scene.filename());
+    }
+  }
+
+  // All the filters of the mixture, as convolved by Mixture::convolve
+  vector<HOGPyramid::Level> filters;
+
+  for (int i = 0; i < mixture.models().size(); ++i)
+    for (int j = 0; j < mixture.models()[i].parts().size(); ++j)
+      filters.push_back(mixture.models()[i].parts()[j].filter);
+
+  const int nbFilters = static_cast<int>(filters.size());
+
+  // The packing algorithms to compare
+  const Patchwork::Packing Packings[3] =
+  {
+    Patchwork::BOTTOM_LEFT_FILL, Patchwork::SKYLINE, Patchwork::MIN_PLANES
+  };
+
+  const string Names[3] = {"bottom-left fill", "skyline", "min planes"};
+
+  int nbPlanes[3] = {0, 0, 0};
+  double packTimes[3] = {0.0, 0.0, 0.0};
+  double convolveTimes[3] = {0.0, 0.0, 0.0};
+  double costs[3] = {0.0, 0.0, 0.0};
+
+  // Transformed filters for each size of planes
+  map<pair<int, int>, vector<Patchwork::Filter> > transformed;
+
+  cout << "Benchmarking " << files.size() << " images: \0337" << flush;
+
+  for (int i = 0; i < files.size(); ++i) {
+    const JPEGImage image(files[i]);
+
+    if (image.empty()) {
+      cerr << "\nInvalid image " << files[i] << endl;
+      return -1;
+    }
+
+    const HOGPyramid pyramid(image, padding, padding, interval, approximate);
+
+    if (pyramid.empty()) {
+      cerr << "\nInvalid image " << files[i] << endl;
+      return -1;
+    }
+
+    for (int j = 0; j < 3; ++j) {
+      // A first patchwork creates the FFTW plans of its size so that their creation is not timed
+      pair<int, int> size;
+
+      {
+        const Patchwork warmup(pyramid, nbFilters, Packings[j]);
+
+        if (warmup.empty()) {
+          cerr << "\nCould not create the patchwork of image " << files[i] << endl;
+          return -1;
+        }
+
+        size = make_pair(warmup.rows(), warmup.cols());
+      }
+
+      vector<Patchwork::Filter> & filtersTransformed = transformed[size];
+
+      if (filtersTransformed.empty()) {
+        filtersTransformed.resize(nbFilters);
+
+        for (int k = 0; k < nbFilters; ++k)
+          Patchwork::TransformFilter(filters[k], size.first, size.second, filtersTransformed[k]);
+      }
+
+      const double packStart = milliseconds();
+      const Patchwork patchwork(pyramid, nbFilters, Packings[j]);
+      const double packStop = milliseconds();
+
+      vector<vector<HOGPyramid::Matrix> > convolutions(nbFilters);
+
+      patchwork.convolve(filtersTransformed, convolutions);
+
+      const double convolveStop = milliseconds();
+
+      nbPlanes[j] += patchwork.nbPlanes();
+      packTimes[j] += packStop - packStart;
+      convolveTimes[j] += convolveStop - packStop;
+      costs[j] += patchwork.cost();
+    }
+
+    cout << "\0338" << (i + 1) << '/' << files.size() << flush;
+  }
+
+  cout << endl << setw(16) << "packing" << setw(8) << "planes" << setw(14) << "cost (GFLOP)"
+     << setw(16) << "patchwork (ms)" << setw(19) << "convolutions (ms)" << endl << fixed;
+
+  for (int j = 0; j < 3; ++j)
+    cout << setw(16) << Names[j] << setw(8) << nbPlanes[j] << setw(14) << setprecision(2)
+       << costs[j] * 1e-9 << setw(16) << setprecision(1) << packTimes[j] << setw(19)
+       << convolveTimes[j] << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+//--------------------------------------------------------------------------------------------------
+// Implementation of the papers "Exact Acceleration of Linear Object Detectors", 12th European
+// Conference on Computer Vision, 2012 and "Deformable Part Models with Individual Part Scaling",
+// 24th British Machine Vision Conference, 2013.
+//
+// Copyright (c) 2013 Idiap Research Institute, <http://www.idiap.ch/>
+// Written by Charles Dubout <charles.dubout@idiap.ch>
+//
+// This file is part of FFLDv2 (the Fast Fourier Linear Detector version 2)
+//
+// FFLDv2 is free software: you can redistribute it and/or modify it under the terms of the GNU
+// Affero General Public License version 3 as published by the Free Software Foundation.
+//
+// FFLDv2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+// the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero
+// General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License along with FFLDv2. If
+// not, see <http://www.gnu.org/licenses/>.
+//--------------------------------------------------------------------------------------------------
+
+#include "SimpleOpt.h"
+
+#include "Mixture.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/time.h>
+
+inline double milliseconds()
+{
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+#else
+#include <time.h>
+#include <windows.h>
+
+inline double milliseconds()
+{
+  ULARGE_INTEGER now;
+  GetSystemTimeAsFileTime((FILETIME *)&now);
+  return now.QuadPart / 10000.0;
+}
+#endif
+
+using namespace FFLD;
+using namespace std;
+
+// SimpleOpt array of valid options
+enum
+{
+  OPT_INTERVAL, OPT_HELP, OPT_MODEL, OPT_PADDING, OPT_RESULT
+};
+
+CSimpleOpt::SOption SOptions[] =
+{
+  { OPT_INTERVAL, "-e", SO_REQ_SEP },
+  { OPT_INTERVAL, "--interval", SO_REQ_SEP },
+  { OPT_HELP, "-h", SO_NONE },
+  { OPT_HELP, "--help", SO_NONE },
+  { OPT_MODEL, "-m", SO_REQ_SEP },
+  { OPT_MODEL, "--model", SO_REQ_SEP },
+  { OPT_PADDING, "-p", SO_REQ_SEP },
+  { OPT_PADDING, "--padding", SO_REQ_SEP },
+  { OPT_RESULT, "-r", SO_REQ_SEP },
+  { OPT_RESULT, "--result", SO_REQ_SEP },
+  SO_END_OF_OPTIONS
+};
+
+void showUsage()
+{
+  cout << "Usage: calibrate [options] image.jpg\n\n"
+      "Measures the speeds of the spatial and Fourier (patchwork) convolutions of the pyramid of\n"
+      "an image with the filters of a model, and saves their ratio, used to choose for each\n"
+      "pyramid level the fastest way to convolve it.\n\n"
+      "Options:\n"
+      "  -e,--interval <arg>      Number of levels per octave in the HOG pyramid (default 5)"
+      "\n"
+      "  -h,--help                Display this information\n"
+      "  -m,--model <file>        Read the input model from <file> (default \"model.txt\")\n"
+      "  -p,--padding <arg>       Amount of zero padding in HOG cells (default 6)\n"
+      "  -r,--result <file>       Write the calibration to <file> (default \"calibration.txt\")"
+     << endl;
+}
+
+int main(int argc, char ** argv)
+{
+  // Default parameters
+  int interval = 5;
+  string model("model.txt");
+  int padding = 6;
+  string result("calibration.txt");
+
+  // Parse the parameters
+  CSimpleOpt args(argc, argv, SOptions);
+
+  while (args.Next()) {
+    if (args.LastError() == SO_SUCCESS) {
+      if (args.OptionId() == OPT_INTERVAL) {
+        interval = atoi(args.OptionArg());
+
+        // Error checking
+        if (interval <= 0) {
+          showUsage();
+          cerr << "\nInvalid interval arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_HELP) {
+        showUsage();
+        return 0;
+      }
+      else if (args.OptionId() == OPT_MODEL) {
+        model = args.OptionArg();
+      }
+      else if (args.OptionId() == OPT_PADDING) {
+        padding = atoi(args.OptionArg());
+
+        if (padding <= 1) {
+          showUsage();
+          cerr << "\nInvalid padding arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_RESULT) {
+        result = args.OptionArg();
+      }
+    }
+    else {
+      showUsage();
+      cerr << "\nUnknown option " << args.OptionText() << endl;
+      return -1;
+    }
+  }
+
+  if (args.FileCount() != 1) {
+    showUsage();
+    cerr << "\nOne image must be provided" << endl;
+    return -1;
+  }
+
+  // Try to open the mixture
+  ifstream in(model.c_str(), ios::binary);
+
+  if (!in.is_open()) {
+    showUsage();
+    cerr << "\nInvalid model file " << model << endl;
+    return -1;
+  }
+
+  Mixture mixture;
+  in >> mixture;
+
+  if (mixture.empty()) {
+    showUsage();
+    cerr << "\nInvalid model file " << model << endl;
+    return -1;
+  }
+
+  const JPEGImage image(args.File(0));
+
+  if (image.empty()) {
+    showUsage();
+    cerr << "\nInvalid image " << args.File(0) << endl;
+    return -1;
+  }
+
+  const HOGPyramid pyramid(image, padding, padding, interval);
+
+  if (pyramid.empty()) {
+    showUsage();
+    cerr << "\nInvalid image " << args.File(0) << endl;
+    return -1;
+  }
+
+  // All the filters of the mixture, as convolved by Mixture::convolve
+  vector<const HOGPyramid::Level *> filters;
+  vector<pair<int, int> > sizes;
+
+  for (int i = 0; i < mixture.models().size(); ++i) {
+    for (int j = 0; j < mixture.models()[i].parts().size(); ++j) {
+      filters.push_back(&mixture.models()[i].parts()[j].filter);
+      sizes.push_back(pair<int, int>(filters.back()->rows(), filters.back()->cols()));
+    }
+  }
+
+  const int nbFilters = static_cast<int>(filters.size());
+  const int nbLevels = static_cast<int>(pyramid.levels().size());
+
+  // Estimated cost of the spatial convolutions of all the levels
+  double spatialCost = 0.0;
+
+  for (int i = 0; i < nbLevels; ++i)
+    for (int j = 0; j < nbFilters; ++j)
+      spatialCost += Patchwork::SpatialCost(pyramid.levels()[i].rows(),
+                          pyramid.levels()[i].cols(), sizes[j].first,
+                          sizes[j].second);
+
+  // Keep the best of a few runs of each kind of convolutions
+  const int NbRuns = 3;
+
+  double spatialTime = numeric_limits<double>::infinity();
+
+  for (int r = 0; r < NbRuns; ++r) {
+    vector<vector<HOGPyramid::Matrix> > convolutions;
+
+    const double start = milliseconds();
+
+    // All the filters at once, as the levels convolved in the spatial domain by Mixture::convolve
+    pyramid.convolve(filters, convolutions);
+
+    spatialTime = min(spatialTime, milliseconds() - start);
+  }
+
+  // A first patchwork creates the FFTW plans of its size so that their creation is not timed
+  vector<Patchwork::Filter> transformed(nbFilters);
+  double fourierCost = 0.0;
+
+  {
+    const Patchwork warmup(pyramid, nbFilters);
+
+    if (warmup.empty()) {
+      cerr << "\nCould not create the patchwork of image " << args.File(0) << endl;
+      return -1;
+    }
+
+    for (int j = 0; j < nbFilters; ++j)
+      Patchwork::TransformFilter(*filters[j], warmup.rows(), warmup.cols(), transformed[j]);
+
+    fourierCost = warmup.cost();
+  }
+
+  double fourierTime = numeric_limits<double>::infinity();
+  Patchwork::Workspace workspace;
+
+  for (int r = 0; r < NbRuns; ++r) {
+    vector<vector<HOGPyramid::Matrix> > convolutions;
+
+    const double start = milliseconds();
+
+    const Patchwork patchwork(pyramid, nbFilters);
+
+    patchwork.convolve(transformed, convolutions, &workspace);
+
+    fourierTime = min(fourierTime, milliseconds() - start);
+  }
+
+  if ((spatialCost <= 0.0) || (fourierCost <= 0.0) || (spatialTime <= 0.0) ||
+    (fourierTime <= 0.0)) {
+    cerr << "\nCould not time the convolutions of image " << args.File(0) << endl;
+    return -1;
+  }
+
+  Patchwork::SetSpatialRatio((spatialTime / spatialCost) / (fourierTime / fourierCost));
+
+  cout << fixed << setprecision(1) << "Spatial convolutions: " << spatialTime << " ms ("
+     << setprecision(2) << spatialCost / (spatialTime * 1e6) << " GFLOPS)" << endl
+     << setprecision(1) << "Fourier convolutions: " << fourierTime << " ms (" << setprecision(2)
+     << fourierCost / (fourierTime * 1e6) << " GFLOPS)" << endl
+     << setprecision(3) << "Ratio: " << Patchwork::SpatialRatio() << endl;
+
+  // Show the resulting choice for each level
+  vector<bool> levels;
+
+  Patchwork::SelectLevels(pyramid, sizes, levels);
+
+  cout << endl << setw(8) << "level" << setw(12) << "size" << setw(14) << "spatial (ms)"
+     << setw(14) << "Fourier (ms)" << endl;
+
+  for (int i = 0; i < nbLevels; ++i) {
+    const int rows = static_cast<int>(pyramid.levels()[i].rows());
+    const int cols = static_cast<int>(pyramid.levels()[i].cols());
+
+    double spatial = 0.0;
+
+    for (int j = 0; j < nbFilters; ++j)
+      spatial += Patchwork::SpatialCost(rows, cols, sizes[j].first, sizes[j].second);
+
+    const double fourier = Patchwork::LevelCost(rows - pyramid.pady(), cols - pyramid.padx(),
+                          nbFilters);
+
+    ostringstream size;
+    size << rows << 'x' << cols;
+
+    cout << setw(8) << i << setw(12) << size.str() << setprecision(3) << setw(14)
+       << spatial * spatialTime / spatialCost << setw(14) << fourier * fourierTime / fourierCost
+       << (levels[i] ? "  Fourier" : "  spatial") << endl;
+  }
+
+  if (!Patchwork::SaveCalibration(result)) {
+    cerr << "\nCould not write the calibration to " << result << endl;
+    return -1;
+  }
+
+  return EXIT_SUCCESS;
+}
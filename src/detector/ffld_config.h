@@ -17,6 +17,8 @@ namespace featpipe {
 
   struct FFLDConfig {
     string model_file;
+    // speeds of the spatial and Fourier convolutions measured by the calibrate executable
+    string calibration_file = "calibration.txt";
     float threshold = 0.3; // min detection threshold
     float overlap = 0.2; // min overlap in non-maximal suppression
 
@@ -13,9 +13,6 @@
 using FFLD::HOGPyramid;
 using FFLD::Mixture;
 using FFLD::Model;
-using FFLD::Intersector;
-using FFLD::Rectangle;
-using FFLD::Patchwork;
 
 using std::pair;
 
@@ -23,7 +20,7 @@ namespace featpipe {
 
 vector<vector<Detection> > FFLDDetector::detect(const vector<Mat>& images) {
 
-  vector<vector<Detection> > detections;
+  vector<vector<Detection> > detections(images.size());
 
   int i;
   #pragma omp parallel for private(i)
@@ -50,89 +47,62 @@ vector<vector<Detection> > FFLDDetector::detect(const vector<Mat>& images) {
     // wrap in JPEGImage compatible interface
     MatJPEGImage image(image_mat);
 
-    // construct HOG pyramid for current image
-    HOGPyramid pyramid(image, config_.padding, config_.padding, config_.interval);
-    vector<Detection> im_detections;
-
-    // compute the scores
-    vector<HOGPyramid::Matrix> scores;
-    vector<Mixture::Indices> argmaxes;
-    vector<vector<vector<Model::Positions> > > positions;
-
-    mixture_.convolve(pyramid, scores, argmaxes, &positions);
-
-    // Cache the size of the models
-    vector<pair<int, int> > sizes(mixture_.models().size());
-
-    for (int i = 0; i < sizes.size(); ++i)
-      sizes[i] = mixture_.models()[i].rootSize();
-
-    int im_width = image.width();
-    int im_height = image.height();
-
-    // For each scale
-    for (int z = 0; z < scores.size(); ++z) {
-      const double scale = pow(2.0, static_cast<double>(z) / pyramid.interval() + 2);
-
-      const int rows = static_cast<int>(scores[z].rows());
-      const int cols = static_cast<int>(scores[z].cols());
-
-      for (int y = 0; y < rows; ++y) {
-        for (int x = 0; x < cols; ++x) {
-          const double score = scores[z](y, x);
-
-          if (score > config_.threshold) {
-            // Non-maxima suppresion in a 3x3 neighborhood
-            if (((y == 0) || (x == 0) || (score >= scores[z](y - 1, x - 1))) &&
-                ((y == 0) || (score >= scores[z](y - 1, x))) &&
-                ((y == 0) || (x == cols - 1) || (score >= scores[z](y - 1, x + 1))) &&
-                ((x == 0) || (score >= scores[z](y, x - 1))) &&
-                ((x == cols - 1) || (score >= scores[z](y, x + 1))) &&
-                ((y == rows - 1) || (x == 0) || (score >= scores[z](y + 1, x - 1))) &&
-                ((y == rows - 1) || (score >= scores[z](y + 1, x))) &&
-                ((y == rows - 1) || (x == cols - 1) ||
-                 (score >= scores[z](y + 1, x + 1)))) {
-              // store truncated bb
-              int x = std::max(static_cast<int>((x - pyramid.padx()) * scale + 0.5), 0);
-              int y = std::max(static_cast<int>((y - pyramid.pady()) * scale + 0.5), 0);
-              int width = std::min(static_cast<int>(sizes[argmaxes[z](y, x)].second * scale + 0.5),
-                                   im_width - x);
-              int height = std::min(static_cast<int>(sizes[argmaxes[z](y, x)].first * scale + 0.5),
-                                    im_height - y);
-              Rect bb(x, y, width, height);
-
-              if (bb.area() > 0)
-                im_detections.push_back(Detection(score, bb));
-            }
-          }
-        }
-      }
-    }
+    detections[i] = detectImage_(image);
+  }
 
-    // Non maxima suppression
-    sort(im_detections.begin(), im_detections.end());
+  return detections;
 
-    for (int i = 1; i < im_detections.size(); ++i) {
-      Rectangle ref(im_detections[i-1].rect.x, im_detections[i-1].rect.y,
-                    im_detections[i-1].rect.width, im_detections[i-1].rect.height);
-      Intersector intersector(ref, config_.overlap, true);
+}
 
-      im_detections.resize(remove_if(im_detections.begin() + i, im_detections.end(),
-                                     [intersector](const Detection& d){
-                                       Rectangle r(d.rect.x, d.rect.y, d.rect.width, d.rect.height);
-                                       return intersector(r);
-                                     }) -
-                           im_detections.begin());
-    }
+vector<vector<Detection> > FFLDDetector::detectJPEG(const vector<pair<const uint8_t*, size_t> >& jpegs) {
 
-    detections.push_back(im_detections);
+  vector<vector<Detection> > detections(jpegs.size());
 
+  int i;
+  #pragma omp parallel for private(i)
+  for (i = 0; i < jpegs.size(); ++i) {
+    // decode (at a reduced size using the DCT scaling of libjpeg if needed)
+    FFLD::JPEGImage image(jpegs[i].first, jpegs[i].second, max_im_size_);
+
+    if (!image.empty())
+      detections[i] = detectImage_(image);
   }
 
   return detections;
 
 }
 
+vector<Detection> FFLDDetector::detectImage_(const FFLD::ImageView& image) {
+
+  // the pyramid and convolution memory of the previous images of the calling thread (whether an
+  // OpenMP or a server thread) is reused
+  static thread_local HOGPyramid::Workspace pyramid_workspace;
+  static thread_local FFLD::Patchwork::Workspace workspace;
+
+  // construct HOG pyramid for current image
+  HOGPyramid pyramid(image, config_.padding, config_.padding, config_.interval, false,
+                     &pyramid_workspace);
+  vector<Detection> im_detections;
+
+  // detect the objects
+  vector<Mixture::Detection> detections;
+
+  mixture_.detect(pyramid, image.width(), image.height(), config_.threshold, config_.overlap, 0,
+                  detections, false, &workspace);
+
+  // give the levels back for the next image
+  pyramid.release(pyramid_workspace);
+
+  // the boxes are already truncated to the image and suppressed
+  for (int i = 0; i < detections.size(); ++i)
+    im_detections.push_back(Detection(detections[i].score,
+                                      Rect(detections[i].x(), detections[i].y(),
+                                           detections[i].width(), detections[i].height())));
+
+  return im_detections;
+
+}
+
 void FFLDDetector::initFromConfig_() {
 
   // load model
@@ -142,13 +112,14 @@ void FFLDDetector::initFromConfig_() {
   in >> mixture_;
   CHECK(!mixture_.empty());
 
-  // init patchwork class for fast convolutions
-  LOG(INFO) << "Initializing patchwork class...";
-  CHECK(Patchwork::InitFFTW((max_im_size_ + 15) & ~15, (max_im_size_ + 15) & ~15)) <<
-    "Error initializing Patchwork class";
+  // choose between the spatial and Fourier convolutions of each pyramid level using the speeds
+  // measured on this machine (the ratio is shared by all the detectors of the process)
+  if (!FFLD::Patchwork::LoadCalibration(config_.calibration_file))
+    LOG(WARNING) << "Could not read the calibration file " << config_.calibration_file
+                 << ", assuming spatial and Fourier convolutions of the same speed";
 
-  // pre-cache transformed filters
-  mixture_.cacheFilters();
+  // the patchwork planes are sized for each image, and the filters transformed for each new
+  // size when first needed
 
 }
 
@@ -10,8 +10,11 @@
 #include "generic_detector.h"
 #include "ffld_config.h"
 
+#include <utility>
+
 // FFLD headers
 #include "Intersector.h"
+#include "JPEGImage.h"
 #include "Mixture.h"
 #include "Scene.h"
 
@@ -47,8 +50,12 @@ namespace featpipe {
       }*/
     // main functions
     virtual vector<vector<Detection> > detect(const vector<Mat>& images);
+    // detect directly from jpeg files in memory (e.g. received from a queue),
+    // decoded at a reduced size if larger than max_im_size_
+    vector<vector<Detection> > detectJPEG(const vector<std::pair<const uint8_t*, size_t> >& jpegs);
   protected:
     void initFromConfig_();
+    vector<Detection> detectImage_(const FFLD::ImageView& image);
     FFLDConfig config_;
 
     FFLD::Mixture mixture_;
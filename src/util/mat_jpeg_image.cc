@@ -7,40 +7,14 @@ namespace featpipe {
   MatJPEGImage::MatJPEGImage() {}
 
   MatJPEGImage::MatJPEGImage(Mat image)
-    :image_(image) {
+    : FFLD::ImageView(image.data, image.cols, image.rows, image.channels(),
+                      static_cast<int>(image.step))
+    , image_(image) {
     CHECK_EQ(image_.type(), CV_8UC3);
   }
 
-  bool MatJPEGImage::empty() const {
-    return image_.empty();
-  }
-
-  int MatJPEGImage::width() const {
-    return image_.cols;
-  }
-
-  int MatJPEGImage::height() const {
-    return image_.rows;
-  }
-
-  int MatJPEGImage::depth() const {
-    return image_.channels();
-  }
-
-  const uint8_t* MatJPEGImage::bits() const {
-    return static_cast<uint8_t*>(image_.data);
-  }
-
-  uint8_t* MatJPEGImage::bits() {
-    return static_cast<uint8_t*>(image_.data);
-  }
-
-  const uint8_t* MatJPEGImage::scanLine(int y) const {
-    return image_.ptr(y);
-  }
-
-  uint8_t* MatJPEGImage::scanLine(int y) {
-    return image_.ptr(y);
+  const Mat& MatJPEGImage::mat() const {
+    return image_;
   }
 
   void MatJPEGImage::save(const string& filename, int quality) const {
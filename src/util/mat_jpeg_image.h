@@ -20,20 +20,14 @@ using cv::Mat;
 
 namespace featpipe {
 
-  class MatJPEGImage : public FFLD::JPEGImage {
+  // Zero-copy view of an OpenCV Mat (which it keeps alive), usable
+  // wherever ffld2 expects an image (e.g. to construct a HOGPyramid)
+  class MatJPEGImage : public FFLD::ImageView {
   public:
     MatJPEGImage();
     MatJPEGImage(Mat image);
 
-    bool empty() const;
-    int width() const;
-    int height() const;
-    int depth() const;
-
-    const uint8_t* bits() const;
-    uint8_t* bits();
-    const uint8_t* scanLine(int y) const;
-    uint8_t* scanLine(int y);
+    const Mat& mat() const;
 
     void save(const string& filename, int quality = 100) const;
     MatJPEGImage* create_rescale(double scale) const;
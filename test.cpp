@@ -22,7 +22,7 @@
 #include "SimpleOpt.h"
 
 #include "Intersector.h"
-#include "Mixture.h"
+#include "MixtureSet.h"
 #include "Scene.h"
 
 #include <algorithm>
@@ -30,6 +30,10 @@
 #include <iomanip>
 #include <iostream>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #ifndef _WIN32
 #include <sys/time.h>
 
@@ -49,6 +53,13 @@ inline int stop()
 
   return static_cast<int>(duration.tv_sec * 1000 + (duration.tv_usec + 500) / 1000);
 }
+
+inline double milliseconds()
+{
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
 #else
 #include <time.h>
 #include <windows.h>
@@ -66,38 +77,26 @@ inline int stop()
   Stop.QuadPart -= Start.QuadPart;
   return static_cast<int>((Stop.QuadPart + 5000) / 10000);
 }
+
+inline double milliseconds()
+{
+  ULARGE_INTEGER now;
+  GetSystemTimeAsFileTime((FILETIME *)&now);
+  return now.QuadPart / 10000.0;
+}
 #endif
 
 using namespace FFLD;
 using namespace std;
 
-struct Detection : public Rectangle
-{
-  HOGPyramid::Scalar score;
-  int x;
-  int y;
-  int z;
-
-  Detection() : score(0), x(0), y(0), z(0)
-  {
-  }
-
-  Detection(HOGPyramid::Scalar score, int x, int y, int z, Rectangle bndbox) : Rectangle(bndbox),
-  score(score), x(x), y(y), z(z)
-  {
-  }
-
-  bool operator<(const Detection & detection) const
-  {
-    return score > detection.score;
-  }
-};
+typedef Mixture::Detection Detection;
 
 // SimpleOpt array of valid options
 enum
 {
   OPT_INTERVAL, OPT_HELP, OPT_IMAGES, OPT_MODEL, OPT_NAME, OPT_PADDING, OPT_RESULT,
-  OPT_THRESHOLD, OPT_OVERLAP, OPT_NB_NEG
+  OPT_THRESHOLD, OPT_OVERLAP, OPT_NB_NEG, OPT_APPROXIMATE, OPT_MIN_HEIGHT, OPT_MAX_HEIGHT,
+  OPT_CASCADE
 };
 
 CSimpleOpt::SOption SOptions[] =
@@ -122,6 +121,14 @@ CSimpleOpt::SOption SOptions[] =
   { OPT_OVERLAP, "--overlap", SO_REQ_SEP },
   { OPT_NB_NEG, "-z", SO_REQ_SEP },
   { OPT_NB_NEG, "--nb-negatives", SO_REQ_SEP },
+  { OPT_APPROXIMATE, "-a", SO_NONE },
+  { OPT_APPROXIMATE, "--approximate", SO_NONE },
+  { OPT_MIN_HEIGHT, "-l", SO_REQ_SEP },
+  { OPT_MIN_HEIGHT, "--min-height", SO_REQ_SEP },
+  { OPT_MAX_HEIGHT, "-u", SO_REQ_SEP },
+  { OPT_MAX_HEIGHT, "--max-height", SO_REQ_SEP },
+  { OPT_CASCADE, "-c", SO_NONE },
+  { OPT_CASCADE, "--cascade", SO_NONE },
   SO_END_OF_OPTIONS
 };
 
@@ -129,15 +136,21 @@ void showUsage()
 {
   cout << "Usage: test [options] image.jpg, or\n       test [options] image_set.txt\n\n"
       "Options:\n"
+      "  -a,--approximate         Approximate the HOG pyramid levels within each octave\n"
+      "  -c,--cascade             Prune the part evaluations with the star-cascade learned by "
+      "train\n"
       "  -e,--interval <arg>      Number of levels per octave in the HOG pyramid (default 5)"
       "\n"
       "  -h,--help                Display this information\n"
       "  -i,--images <folder>     Draw the detections to <folder> (default none)\n"
-      "  -m,--model <file>        Read the input model from <file> (default \"model.txt\")\n"
+      "  -l,--min-height <arg>    Minimum height of the objects in pixels (default none)\n"
+      "  -m,--model <file>        Read the input model from <file> (default \"model.txt\"), "
+      "repeat\n                           to detect several classes in one image\n"
       "  -n,--name <arg>          Name of the object to detect (default \"person\")\n"
       "  -p,--padding <arg>       Amount of zero padding in HOG cells (default 6)\n"
       "  -r,--result <file>       Write the detection result to <file> (default none)\n"
       "  -t,--threshold <arg>     Minimum detection threshold (default -1)\n"
+      "  -u,--max-height <arg>    Maximum height of the objects in pixels (default none)\n"
       "  -v,--overlap <arg>       Minimum overlap in non maxima suppression (default 0.5)\n"
       "  -z,--nb-negatives <arg>  Maximum number of negative images to consider (default all)"
      << endl;
@@ -238,78 +251,76 @@ void draw(JPEGImage & image, const Rectangle & rect, uint8_t r, uint8_t g, uint8
   }
 }
 
-void detect(const Mixture & mixture, int width, int height, const HOGPyramid & pyramid,
-      double threshold, double overlap, const string image, ostream & out,
-      const string & images, vector<Detection> & detections, const Scene * scene = 0,
+// Returns the id of an image (its filename without folder nor extension)
+string imageId(const string & image)
+{
+  string id = image.substr(0, image.find_last_of('.'));
+
+  if (id.find_last_of("/\\") != string::npos)
+    id = id.substr(id.find_last_of("/\\") + 1);
+
+  return id;
+}
+
+// Draws the detections of a mixture (in green if they hit an object of the scene, and in red
+// otherwise) and the positions of their parts (in blue)
+void draw(JPEGImage & im, const Mixture & mixture, const HOGPyramid & pyramid,
+      const vector<Detection> & detections, const Scene * scene = 0,
       Object::Name name = Object::UNKNOWN)
 {
-  // Compute the scores
-  vector<HOGPyramid::Matrix> scores;
-  vector<Mixture::Indices> argmaxes;
-  vector<vector<vector<Model::Positions> > > positions;
-
-  mixture.convolve(pyramid, scores, argmaxes, &positions);
-
-  // Cache the size of the models
-  vector<pair<int, int> > sizes(mixture.models().size());
-
-  for (int i = 0; i < sizes.size(); ++i)
-    sizes[i] = mixture.models()[i].rootSize();
-
-  // For each scale
-  for (int z = 0; z < scores.size(); ++z) {
-    const double scale = pow(2.0, static_cast<double>(z) / pyramid.interval() + 2);
-
-    const int rows = static_cast<int>(scores[z].rows());
-    const int cols = static_cast<int>(scores[z].cols());
-
-    for (int y = 0; y < rows; ++y) {
-      for (int x = 0; x < cols; ++x) {
-        const double score = scores[z](y, x);
-
-        if (score > threshold) {
-          // Non-maxima suppresion in a 3x3 neighborhood
-          if (((y == 0) || (x == 0) || (score >= scores[z](y - 1, x - 1))) &&
-            ((y == 0) || (score >= scores[z](y - 1, x))) &&
-            ((y == 0) || (x == cols - 1) || (score >= scores[z](y - 1, x + 1))) &&
-            ((x == 0) || (score >= scores[z](y, x - 1))) &&
-            ((x == cols - 1) || (score >= scores[z](y, x + 1))) &&
-            ((y == rows - 1) || (x == 0) || (score >= scores[z](y + 1, x - 1))) &&
-            ((y == rows - 1) || (score >= scores[z](y + 1, x))) &&
-            ((y == rows - 1) || (x == cols - 1) ||
-             (score >= scores[z](y + 1, x + 1)))) {
-            Rectangle bndbox((x - pyramid.padx()) * scale + 0.5,
-                     (y - pyramid.pady()) * scale + 0.5,
-                     sizes[argmaxes[z](y, x)].second * scale + 0.5,
-                     sizes[argmaxes[z](y, x)].first * scale + 0.5);
-
-            // Truncate the object
-            bndbox.setX(max(bndbox.x(), 0));
-            bndbox.setY(max(bndbox.y(), 0));
-            bndbox.setWidth(min(bndbox.width(), width - bndbox.x()));
-            bndbox.setHeight(min(bndbox.height(), height - bndbox.y()));
-
-            if (!bndbox.empty())
-              detections.push_back(Detection(score, x, y, z, bndbox));
-          }
-        }
-      }
+  for (int i = 0; i < detections.size(); ++i) {
+    // Find out if the detection hits an object
+    bool positive = false;
+
+    if (scene) {
+      Intersector intersector(detections[i]);
+
+      for (int j = 0; j < scene->objects().size(); ++j)
+        if (scene->objects()[j].name() == name)
+          if (intersector(scene->objects()[j].bndbox()))
+            positive = true;
     }
-  }
 
-  // Non maxima suppression
-  sort(detections.begin(), detections.end());
+    const int argmax = detections[i].model;
 
-  for (int i = 1; i < detections.size(); ++i)
-    detections.resize(remove_if(detections.begin() + i, detections.end(),
-                  Intersector(detections[i - 1], overlap, true)) -
-              detections.begin());
+    vector<Model::Position> positions;
 
-  // Find the image id
-  string id = image.substr(0, image.find_last_of('.'));
+    mixture.models()[argmax].backtrack(pyramid, detections[i].root(0), detections[i].root(1),
+                       detections[i].root(2), positions);
 
-  if (id.find_last_of("/\\") != string::npos)
-    id = id.substr(id.find_last_of("/\\") + 1);
+    for (int j = 0; j < positions.size(); ++j) {
+      const int xp = positions[j](0);
+      const int yp = positions[j](1);
+      const int zp = positions[j](2);
+
+      const double scale = pow(2.0, static_cast<double>(zp) / pyramid.interval() + 2);
+
+      const Rectangle bndbox((xp - pyramid.padx()) * scale + 0.5,
+                   (yp - pyramid.pady()) * scale + 0.5,
+                   mixture.models()[argmax].partSize().second * scale + 0.5,
+                   mixture.models()[argmax].partSize().first * scale + 0.5);
+
+      draw(im, bndbox, 0, 0, 255, 2);
+    }
+
+    // Draw the root last
+    draw(im, detections[i], positive ? 0 : 255, positive ? 255 : 0, 0, 2);
+  }
+}
+
+void detect(const Mixture & mixture, int width, int height, const HOGPyramid & pyramid,
+      double threshold, double overlap, bool cascade, const string image, ostream & out,
+      const string & images, vector<Detection> & detections, const Scene * scene = 0,
+      Object::Name name = Object::UNKNOWN, Patchwork::Workspace * workspace = 0,
+      double * skipped = 0)
+{
+  // Compute the detections (the positions of the parts are only recovered for the final
+  // detections, see Model::backtrack)
+  mixture.detect(pyramid, width, height, threshold, overlap, 0, detections, cascade, workspace,
+           skipped);
+
+  // Find the image id
+  const string id = imageId(image);
 
   // Print the detections
   if (out) {
@@ -336,43 +347,7 @@ void detect(const Mixture & mixture, int width, int height, const HOGPyramid & p
   if (!images.empty()) {
     JPEGImage im(image);
 
-    for (int i = 0; i < detections.size(); ++i) {
-      // Find out if the detection hits an object
-      bool positive = false;
-
-      if (scene) {
-        Intersector intersector(detections[i]);
-
-        for (int j = 0; j < scene->objects().size(); ++j)
-          if (scene->objects()[j].name() == name)
-            if (intersector(scene->objects()[j].bndbox()))
-              positive = true;
-      }
-
-      const int argmax = argmaxes[detections[i].z](detections[i].y, detections[i].x);
-
-      const int x = detections[i].x;
-      const int y = detections[i].y;
-      const int z = detections[i].z;
-
-      for (int j = 0; j < positions[argmax].size(); ++j) {
-        const int xp = positions[argmax][j][z](y, x)(0);
-        const int yp = positions[argmax][j][z](y, x)(1);
-        const int zp = positions[argmax][j][z](y, x)(2);
-
-        const double scale = pow(2.0, static_cast<double>(zp) / pyramid.interval() + 2);
-
-        const Rectangle bndbox((xp - pyramid.padx()) * scale + 0.5,
-                     (yp - pyramid.pady()) * scale + 0.5,
-                     mixture.models()[argmax].partSize().second * scale + 0.5,
-                     mixture.models()[argmax].partSize().first * scale + 0.5);
-
-        draw(im, bndbox, 0, 0, 255, 2);
-      }
-
-      // Draw the root last
-      draw(im, detections[i], positive ? 0 : 255, positive ? 255 : 0, 0, 2);
-    }
+    draw(im, mixture, pyramid, detections, scene, name);
 
     im.save(images + '/' + id + ".jpg");
   }
@@ -383,13 +358,17 @@ int main(int argc, char ** argv)
   // Default parameters
   int interval = 5;
   string images;
-  string model("model.txt");
+  vector<string> models;
   Object::Name name = Object::PERSON;
   int padding = 6;
   string result;
   double threshold = -1.0;
   double overlap = 0.5;
   int nbNegativeScenes = -1;
+  bool approximate = false;
+  bool cascade = false;
+  int minHeight = 0;
+  int maxHeight = 0;
 
   // Parse the parameters
   CSimpleOpt args(argc, argv, SOptions);
@@ -414,7 +393,7 @@ int main(int argc, char ** argv)
         images = args.OptionArg();
       }
       else if (args.OptionId() == OPT_MODEL) {
-        model = args.OptionArg();
+        models.push_back(args.OptionArg());
       }
       else if (args.OptionId() == OPT_NAME) {
         string arg = args.OptionArg();
@@ -461,6 +440,30 @@ int main(int argc, char ** argv)
           return -1;
         }
       }
+      else if (args.OptionId() == OPT_APPROXIMATE) {
+        approximate = true;
+      }
+      else if (args.OptionId() == OPT_CASCADE) {
+        cascade = true;
+      }
+      else if (args.OptionId() == OPT_MIN_HEIGHT) {
+        minHeight = atoi(args.OptionArg());
+
+        if (minHeight <= 0) {
+          showUsage();
+          cerr << "\nInvalid min-height arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
+      else if (args.OptionId() == OPT_MAX_HEIGHT) {
+        maxHeight = atoi(args.OptionArg());
+
+        if (maxHeight <= 0) {
+          showUsage();
+          cerr << "\nInvalid max-height arg " << args.OptionArg() << endl;
+          return -1;
+        }
+      }
       else if (args.OptionId() == OPT_NB_NEG) {
         nbNegativeScenes = atoi(args.OptionArg());
 
@@ -489,24 +492,59 @@ int main(int argc, char ** argv)
     return -1;
   }
 
-  // Try to open the mixture
-  ifstream in(model.c_str(), ios::binary);
+  // Use the speeds of the spatial and Fourier convolutions measured by calibrate, if any
+  Patchwork::LoadCalibration();
 
-  if (!in.is_open()) {
-    showUsage();
-    cerr << "\nInvalid model file " << model << endl;
-    return -1;
+  if (models.empty())
+    models.push_back("model.txt");
+
+  // Try to open the mixtures
+  ifstream in;
+  vector<Mixture> mixtures(models.size());
+
+  for (int i = 0; i < models.size(); ++i) {
+    in.open(models[i].c_str(), ios::binary);
+
+    if (!in.is_open()) {
+      showUsage();
+      cerr << "\nInvalid model file " << models[i] << endl;
+      return -1;
+    }
+
+    in >> mixtures[i];
+    in.close();
+
+    if (mixtures[i].empty()) {
+      showUsage();
+      cerr << "\nInvalid model file " << models[i] << endl;
+      return -1;
+    }
   }
 
-  Mixture mixture;
-  in >> mixture;
+  const Mixture & mixture = mixtures[0];
+
+  if (cascade && (mixtures.size() > 1))
+    cerr << "The cascades are not used with several models, all the parts will be evaluated"
+       << endl;
+  else if (cascade && mixture.thresholds().empty())
+    cerr << "The model has no cascade thresholds, all the parts will be evaluated" << endl;
 
-  if (mixture.empty()) {
+  if (maxHeight && (minHeight > maxHeight)) {
     showUsage();
-    cerr << "\nInvalid model file " << model << endl;
+    cerr << "\nInvalid height range " << minHeight << '-' << maxHeight << endl;
     return -1;
   }
 
+  // Only compute the pyramid levels at which objects of the right height can be detected
+  pair<double, double> scales = mixture.scaleRange(minHeight, maxHeight);
+
+  for (int i = 1; i < mixtures.size(); ++i) {
+    const pair<double, double> range = mixtures[i].scaleRange(minHeight, maxHeight);
+
+    scales.first = min(scales.first, range.first);
+    scales.second = max(scales.second, range.second);
+  }
+
   // The image/dataset
   const string file(args.File(0));
   const size_t lastDot = file.find_last_of('.');
@@ -518,6 +556,12 @@ int main(int argc, char ** argv)
     return -1;
   }
 
+  if ((mixtures.size() > 1) && (file.substr(lastDot) != ".jpg")) {
+    showUsage();
+    cerr << "\nSeveral models can only be tested on a single image" << endl;
+    return -1;
+  }
+
   // Try to open the result file
   ofstream out;
 
@@ -544,7 +588,8 @@ int main(int argc, char ** argv)
     // Compute the HOG features
     start();
 
-    HOGPyramid pyramid(image, padding, padding, interval);
+    HOGPyramid pyramid(image, padding, padding, interval, approximate, 0, scales.first,
+               scales.second);
 
     if (pyramid.empty()) {
       showUsage();
@@ -554,20 +599,86 @@ int main(int argc, char ** argv)
 
     cout << "Computed HOG features in " << stop() << " ms" << endl;
 
-    // Initialize the Patchwork class
+    // Detect the objects of all the classes at once
+    if (mixtures.size() > 1) {
+      const MixtureSet set(mixtures);
+
+      start();
+
+      vector<vector<Detection> > detections;
+
+      set.detect(pyramid, image.width(), image.height(), threshold, overlap, 0, detections);
+
+      if (detections.empty()) {
+        cerr << "\nCould not compute the detections" << endl;
+        return -1;
+      }
+
+      cout << "Computed the detections of " << mixtures.size() << " models in " << stop()
+         << " ms" << endl;
+
+      const string id = imageId(file);
+      JPEGImage im(image);
+
+      for (int i = 0; i < mixtures.size(); ++i) {
+        cout << models[i] << ": " << detections[i].size() << " detections" << endl;
+
+        // Prefix the detections with their model
+        if (out)
+          for (int j = 0; j < detections[i].size(); ++j)
+            out << id << ' ' << models[i] << ' ' << detections[i][j].score << ' '
+              << (detections[i][j].left() + 1) << ' ' << (detections[i][j].top() + 1) << ' '
+              << (detections[i][j].right() + 1) << ' ' << (detections[i][j].bottom() + 1)
+              << endl;
+
+        if (!images.empty())
+          draw(im, mixtures[i], pyramid, detections[i]);
+      }
+
+      if (!images.empty())
+        im.save(images + '/' + id + ".jpg");
+
+      return 0;
+    }
+
+    // Choose the layout of the patchwork
     start();
 
-    if (!Patchwork::InitFFTW((pyramid.levels()[0].rows() - padding + 15) & ~15,
-                 (pyramid.levels()[0].cols() - padding + 15) & ~15)) {
+    vector<pair<int, int> > sizes;
+
+    for (int i = 0; i < mixture.models().size(); ++i)
+      for (int j = 0; j < mixture.models()[i].parts().size(); ++j)
+        sizes.push_back(pair<int, int>(mixture.models()[i].parts()[j].filter.rows(),
+                       mixture.models()[i].parts()[j].filter.cols()));
+
+    vector<bool> levels;
+
+    Patchwork::SelectLevels(pyramid, sizes, levels);
+
+    // Only choose the size of the planes, the patchwork itself is built by the detection
+    int rows;
+    int cols;
+    vector<pair<Rectangle, int> > layout;
+    double cost;
+
+    const int nbPlanes = Patchwork::Layout(pyramid, static_cast<int>(sizes.size()),
+                         Patchwork::MIN_PLANES, levels, rows, cols, layout,
+                         &cost);
+
+    if (!nbPlanes && (find(levels.begin(), levels.end(), true) != levels.end())) {
       cerr << "\nCould not initialize the Patchwork class" << endl;
       return -1;
     }
 
-    cout << "Initialized FFTW in " << stop() << " ms" << endl;
+    cout << "Laid out " << count(levels.begin(), levels.end(), true) << " of " << levels.size()
+       << " levels (the others are convolved in the spatial domain) in " << nbPlanes
+       << " planes of " << rows << 'x' << cols << " (estimated cost " << cost * 1e-9
+       << " GFLOP) in " << stop() << " ms" << endl;
 
     start();
 
-    mixture.cacheFilters();
+    if (nbPlanes)
+      mixture.cacheFilters(rows, cols);
 
     cout << "Transformed the filters in " << stop() << " ms" << endl;
 
@@ -575,11 +686,19 @@ int main(int argc, char ** argv)
     start();
 
     vector<Detection> detections;
+    double skipped;
+
+    detect(mixture, image.width(), image.height(), pyramid, threshold, overlap, cascade, file,
+         out, images, detections, 0, Object::UNKNOWN, 0, &skipped);
 
-    detect(mixture, image.width(), image.height(), pyramid, threshold, overlap, file, out,
-         images, detections);
+    cout << "Computed the convolutions and distance transforms in " << stop() << " ms";
 
-    cout << "Computed the convolutions and distance transforms in " << stop() << " ms" << endl;
+    // The pruning of the cascades is not counted
+    if (!cascade)
+      cout << " (skipped " << fixed << setprecision(1) << (skipped * 100.0)
+         << "% of the distance transforms)";
+
+    cout << endl;
   }
   else { // ".txt"
     in.close();
@@ -597,9 +716,6 @@ int main(int argc, char ** argv)
     // Load all the scenes
     vector<Scene> scenes;
 
-    int maxRows = 0;
-    int maxCols = 0;
-
     while (in) {
       string line;
       getline(in, line);
@@ -617,31 +733,15 @@ int main(int argc, char ** argv)
         if (!scene.empty()) {
           scenes.push_back(scene);
 
-          maxRows = max(maxRows, (scene.height() + 3) / 4 + padding);
-          maxCols = max(maxCols, (scene.width() + 3) / 4 + padding);
-
           if (!positive)
             --nbNegativeScenes;
         }
       }
     }
 
-    // Initialize the Patchwork class
-    start();
-
-    if (!Patchwork::InitFFTW((maxRows + 15) & ~15, (maxCols + 15) & ~15)) {
-      cerr << "\nCould not initialize the Patchwork class" << endl;
-      return -1;
-    }
-
-    cout << "Initialized FFTW in " << stop() << " ms" << endl;
-
-    start();
-
-    mixture.cacheFilters();
-
-    cout << "Transformed the filters in " << stop() << " ms" << endl << "Testing "
-       << scenes.size() << " scenes: \0337" << flush;
+    // The size of the patchwork planes depends on each scene, the filters are transformed when
+    // first needed
+    cout << "Testing " << scenes.size() << " scenes: \0337" << flush;
 
     start();
 
@@ -656,20 +756,48 @@ int main(int argc, char ** argv)
 
     int nbScenes = 0;
 
+    // Time spent computing the HOG features (cumulated over all the threads)
+    double hogTime = 0.0;
+
     // Most of the computations inside are already multi-threaded but the performance is higher
     // (~20% on my machine) if the threading is done at the level of the scenes rather than at a
     // lower level (pyramid levels/filters)
     // The performance measurements reported in the paper were done without this scene level
     // threading
+    // Each thread reuses the memory of its previous pyramids and convolutions
+#ifdef _OPENMP
+    vector<HOGPyramid::Workspace> workspaces(omp_get_max_threads());
+    vector<Patchwork::Workspace> patchworkWorkspaces(omp_get_max_threads());
+#else
+    vector<HOGPyramid::Workspace> workspaces(1);
+    vector<Patchwork::Workspace> patchworkWorkspaces(1);
+#endif
+
     int i;
 #pragma omp parallel for private(i)
     for (i = 0; i < scenes.size(); ++i) {
+#ifdef _OPENMP
+      HOGPyramid::Workspace & workspace = workspaces[omp_get_thread_num()];
+      Patchwork::Workspace & patchworkWorkspace = patchworkWorkspaces[omp_get_thread_num()];
+#else
+      HOGPyramid::Workspace & workspace = workspaces[0];
+      Patchwork::Workspace & patchworkWorkspace = patchworkWorkspaces[0];
+#endif
       JPEGImage image(scenes[i].filename());
-      HOGPyramid pyramid(image, padding, padding, interval);
+      const double hogStart = milliseconds();
+      HOGPyramid pyramid(image, padding, padding, interval, approximate, &workspace,
+                 scales.first, scales.second);
+      const double hogStop = milliseconds();
       vector<Detection> detections;
 
+#pragma omp atomic
+      hogTime += hogStop - hogStart;
+
       detect(mixture, scenes[i].width(), scenes[i].height(), pyramid, threshold, overlap,
-           scenes[i].filename(), out, images, detections, &scenes[i], name);
+           cascade, scenes[i].filename(), out, images, detections, &scenes[i], name,
+           &patchworkWorkspace);
+
+      pyramid.release(workspace);
 
       // Consider only objects of the right class
       for (int j = 0; j < scenes[i].objects().size(); ++j) {
@@ -727,6 +855,10 @@ int main(int argc, char ** argv)
 
     cout << "\0338100.0% (" << stop() << " ms)" << endl;
 
+    cout << "Computed HOG features in " << static_cast<int>(hogTime + 0.5)
+       << " ms (cumulated over all the threads" << (approximate ? ", approximate" : "") << ')'
+       << endl;
+
     // The score of the detections associated to objects
     vector<double> positives;
 
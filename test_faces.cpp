@@ -71,27 +71,7 @@ inline int stop()
 using namespace FFLD;
 using namespace std;
 
-struct Detection : public Rectangle
-{
-  HOGPyramid::Scalar score;
-  int x_unscaled;
-  int y_unscaled;
-  int z;
-
-  Detection() : score(0), x_unscaled(0), y_unscaled(0), z(0)
-  {
-  }
-
-  Detection(HOGPyramid::Scalar score, int x_unscaled, int y_unscaled, int z, Rectangle bndbox) : Rectangle(bndbox),
-  score(score), x_unscaled(x_unscaled), y_unscaled(y_unscaled), z(z)
-  {
-  }
-
-  bool operator<(const Detection & detection) const
-  {
-    return score > detection.score;
-  }
-};
+typedef Mixture::Detection Detection;
 
 // SimpleOpt array of valid options
 enum
@@ -271,67 +251,8 @@ void detect(const Mixture & mixture, int width, int height, const HOGPyramid & p
             const string base_dir = "",
             const bool output_crops = false)
 {
-  // Compute the scores
-  vector<HOGPyramid::Matrix> scores;
-  vector<Mixture::Indices> argmaxes;
-  vector<vector<vector<Model::Positions> > > positions;
-
-  mixture.convolve(pyramid, scores, argmaxes, &positions);
-
-  // Cache the size of the models
-  vector<pair<int, int> > sizes(mixture.models().size());
-
-  for (int i = 0; i < sizes.size(); ++i)
-    sizes[i] = mixture.models()[i].rootSize();
-
-  // For each scale
-  for (int z = 0; z < scores.size(); ++z) {
-    const double scale = pow(2.0, static_cast<double>(z) / pyramid.interval() + 2);
-
-    const int rows = static_cast<int>(scores[z].rows());
-    const int cols = static_cast<int>(scores[z].cols());
-
-    for (int y = 0; y < rows; ++y) {
-      for (int x = 0; x < cols; ++x) {
-        const double score = scores[z](y, x);
-
-        if (score > threshold) {
-          // Non-maxima suppresion in a 3x3 neighborhood
-          if (((y == 0) || (x == 0) || (score >= scores[z](y - 1, x - 1))) &&
-            ((y == 0) || (score >= scores[z](y - 1, x))) &&
-            ((y == 0) || (x == cols - 1) || (score >= scores[z](y - 1, x + 1))) &&
-            ((x == 0) || (score >= scores[z](y, x - 1))) &&
-            ((x == cols - 1) || (score >= scores[z](y, x + 1))) &&
-            ((y == rows - 1) || (x == 0) || (score >= scores[z](y + 1, x - 1))) &&
-            ((y == rows - 1) || (score >= scores[z](y + 1, x))) &&
-            ((y == rows - 1) || (x == cols - 1) ||
-             (score >= scores[z](y + 1, x + 1)))) {
-            Rectangle bndbox((x - pyramid.padx()) * scale + 0.5,
-                     (y - pyramid.pady()) * scale + 0.5,
-                     sizes[argmaxes[z](y, x)].second * scale + 0.5,
-                     sizes[argmaxes[z](y, x)].first * scale + 0.5);
-
-            // Truncate the object
-            bndbox.setX(max(bndbox.x(), 0));
-            bndbox.setY(max(bndbox.y(), 0));
-            bndbox.setWidth(min(bndbox.width(), width - bndbox.x()));
-            bndbox.setHeight(min(bndbox.height(), height - bndbox.y()));
-
-            if (!bndbox.empty())
-              detections.push_back(Detection(score, x, y, z, bndbox));
-          }
-        }
-      }
-    }
-  }
-
-  // Non maxima suppression
-  sort(detections.begin(), detections.end());
-
-  for (int i = 1; i < detections.size(); ++i)
-    detections.resize(remove_if(detections.begin() + i, detections.end(),
-                                Intersector(detections[i - 1], overlap, true)) -
-                      detections.begin());
+  // Compute the detections
+  mixture.detect(pyramid, width, height, threshold, overlap, 0, detections);
 
   // Find the image id
   string id;
@@ -406,16 +327,17 @@ void detect(const Mixture & mixture, int width, int height, const HOGPyramid & p
                 positive = true;
         }
 
-        const int argmax = argmaxes[detections[i].z](detections[i].y_unscaled, detections[i].x_unscaled);
+        const int argmax = detections[i].model;
+
+        vector<Model::Position> positions;
 
-        const int x = detections[i].x_unscaled;
-        const int y = detections[i].y_unscaled;
-        const int z = detections[i].z;
+        mixture.models()[argmax].backtrack(pyramid, detections[i].root(0), detections[i].root(1),
+                                           detections[i].root(2), positions);
 
-        for (int j = 0; j < positions[argmax].size(); ++j) {
-          const int xp = positions[argmax][j][z](y, x)(0);
-          const int yp = positions[argmax][j][z](y, x)(1);
-          const int zp = positions[argmax][j][z](y, x)(2);
+        for (int j = 0; j < positions.size(); ++j) {
+          const int xp = positions[j](0);
+          const int yp = positions[j](1);
+          const int zp = positions[j](2);
 
           const double scale = pow(2.0, static_cast<double>(zp) / pyramid.interval() + 2);
 
@@ -704,9 +626,6 @@ int main(int argc, char ** argv)
     }
 
     // Load all the scenes
-    int maxRows = 0;
-    int maxCols = 0;
-
     vector<Scene> scenes;
 
     while (in) {
@@ -772,29 +691,13 @@ int main(int argc, char ** argv)
 
       Scene scene(width, height, depth, filename, objects);
 
-      maxRows = max(maxRows, (scene.height() + 3) / 4 + opts.padding);
-      maxCols = max(maxCols, (scene.width() + 3) / 4 + opts.padding);
-
       scenes.push_back(scene);
 
     }
 
-    // Initialize the Patchwork class
-    start();
-
-    if (!Patchwork::InitFFTW((maxRows + 15) & ~15, (maxCols + 15) & ~15)) {
-      cerr << "\nCould not initialize the Patchwork class" << endl;
-      return -1;
-    }
-
-    cout << "Initialized FFTW in " << stop() << " ms" << endl;
-
-    start();
-
-    mixture.cacheFilters();
-
-    cout << "Transformed the filters in " << stop() << " ms" << endl << "Testing "
-       << scenes.size() << " scenes: \0337" << flush;
+    // The size of the patchwork planes depends on each scene, the filters are transformed when
+    // first needed
+    cout << "Testing " << scenes.size() << " scenes: \0337" << flush;
 
     start();
 
@@ -276,9 +276,6 @@ int main(int argc, char * argv[])
   const string folder = file.substr(0, file.find_last_of("/\\")) + "/../../Annotations/";
 
   // Load all the scenes
-  int maxRows = 0;
-  int maxCols = 0;
-
   vector<Scene> scenes;
 
   while (in) {
@@ -310,9 +307,6 @@ int main(int argc, char * argv[])
     if (positive || (negative && nbNegativeScenes)) {
       scenes.push_back(scene);
 
-      maxRows = max(maxRows, (scene.height() + 3) / 4 + padding);
-      maxCols = max(maxCols, (scene.width() + 3) / 4 + padding);
-
       if (negative)
         --nbNegativeScenes;
     }
@@ -324,12 +318,6 @@ int main(int argc, char * argv[])
     return -1;
   }
 
-  // Initialize the Patchwork class
-  if (!Patchwork::InitFFTW((maxRows + 15) & ~15, (maxCols + 15) & ~15)) {
-    cerr << "Error initializing the FFTW library" << endl;
-    return - 1;
-  }
-
   // The mixture to train
   Mixture mixture(nbComponents, scenes, name);
 
@@ -367,6 +355,9 @@ int main(int argc, char * argv[])
   mixture.train(scenes, name, padding, padding, interval, nbRelabel, nbDatamine, 24000, C, J,
           overlap);
 
+  // Learn the pruning thresholds of the star-cascades from the positives (see test --cascade)
+  mixture.trainCascade(scenes, name, padding, padding, interval, overlap);
+
   // Try to open the result file
   ofstream out(result.c_str(), ios::binary);
 
@@ -333,9 +333,6 @@ int main(int argc, char * argv[])
   const string voc_people_anno_file = opts.voc_base_dir + "ImageSets/Main/person_trainval.txt";
 
   // Load all the scenes
-  int maxRows = 0;
-  int maxCols = 0;
-
   vector<Scene> scenes;
 
   // add positive scenes (from AFLW)
@@ -396,9 +393,6 @@ int main(int argc, char * argv[])
 
     Scene scene(width, height, depth, filename, objects);
 
-    maxRows = max(maxRows, (scene.height() + 3) / 4 + opts.padding);
-    maxCols = max(maxCols, (scene.width() + 3) / 4 + opts.padding);
-    
     scenes.push_back(scene);
 
   }
@@ -469,9 +463,6 @@ int main(int argc, char * argv[])
     if (opts.nbNegativeScenes > 0) {
       Scene scene(width, height, depth, filename, objects);
 
-      maxRows = max(maxRows, (scene.height() + 3) / 4 + opts.padding);
-      maxCols = max(maxCols, (scene.width() + 3) / 4 + opts.padding);
-
       scenes.push_back(scene);
 
       --opts.nbNegativeScenes;
@@ -481,7 +472,6 @@ int main(int argc, char * argv[])
 
   cout << num_pos << " positives, " << num_neg << " negatives" << endl;
   cout << "Total scenes: " << scenes.size() << endl;
-  cout << "maxRows: " << maxRows << ", maxCols: " << maxCols << endl;
 
   if (scenes.empty()) {
     showUsage();
@@ -491,13 +481,6 @@ int main(int argc, char * argv[])
 
   {  // START TRAINING
 
-    // Initialize the Patchwork class
-    cout << "Initializing patchwork class..." << endl;
-    if (!Patchwork::InitFFTW((maxRows + 15) & ~15, (maxCols + 15) & ~15)) {
-      cerr << "Error initializing the FFTW library" << endl;
-      return - 1;
-    }
-
     // The mixture to train
     cout << "Initializing mixture..." << endl;
     Mixture mixture(opts.nbComponents, scenes, opts.name);